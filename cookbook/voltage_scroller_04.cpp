@@ -82,15 +82,20 @@ struct MyApp : public App {
     ps.registerDimension(eci4_dim);
 
     // This function provided with a map of parameter name to index into
-    // that parameter knows how to find the folder to run a process from
-    ps.generateRelativeRunPath = [&](std::map<std::string, size_t> indeces) {
-      std::string path = "AMX2_spinel_diffusion_0.0_0.0";
-      for (const auto &mapped_param : ps.dimensions) {
-        path +=
-            mapped_param->idAt(indeces[mapped_param->parameter().getName()]);
-      }
-      return path + "/";
-    };
+    // that parameter knows how to find the folder to run a process from.
+    // Declaring the dimensions the path depends on allows the parameter space
+    // to cache the generated paths, so moving the sliders back to a sample
+    // already visited does not need to regenerate the path.
+    ps.setRunPathGenerator(
+        [&](std::map<std::string, size_t> indeces) {
+          std::string path = "AMX2_spinel_diffusion_0.0_0.0";
+          for (const auto &mapped_param : ps.dimensions) {
+            path += mapped_param->idAt(
+                indeces[mapped_param->parameter().getName()]);
+          }
+          return path + "/";
+        },
+        ps.dimensionNames());
     // Create necessary filesystem directories to be populated by data
     ps.createDataDirectories();
 
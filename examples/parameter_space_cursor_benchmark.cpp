@@ -0,0 +1,78 @@
+#include "tinc/ParameterSpace.hpp"
+
+#include <chrono>
+#include <iostream>
+
+// Compares traversal of a parameter space using the map based
+// incrementIndeces() and the SweepCursor.
+
+int main() {
+  tinc::ParameterSpace ps;
+
+  for (int d = 0; d < 5; d++) {
+    auto dimension = std::make_shared<tinc::ParameterSpaceDimension>(
+        "dim" + std::to_string(d));
+    for (int i = 0; i < 16; i++) {
+      dimension->push_back(i, "value_" + std::to_string(i));
+    }
+    dimension->type = tinc::ParameterSpaceDimension::MAPPED;
+    ps.registerDimension(dimension);
+  }
+
+  uint64_t checksum = 0;
+
+  // Map based traversal
+  auto start = std::chrono::high_resolution_clock::now();
+  std::map<std::string, size_t> currentIndeces;
+  for (auto dimensionName : ps.dimensionNames()) {
+    currentIndeces[dimensionName] = 0;
+  }
+  uint64_t count = 0;
+  do {
+    for (auto dimensionIndex : currentIndeces) {
+      checksum += ps.getDimension(dimensionIndex.first)
+                      ->idAt(dimensionIndex.second)
+                      .size();
+    }
+    count++;
+  } while (!ps.incrementIndeces(currentIndeces));
+  auto end = std::chrono::high_resolution_clock::now();
+  double mapTime = std::chrono::duration<double>(end - start).count();
+
+  // Cursor based traversal
+  start = std::chrono::high_resolution_clock::now();
+  tinc::SweepCursor cursor = ps.createCursor();
+  uint64_t cursorCount = 0;
+  do {
+    for (size_t i = 0; i < cursor.dimensionCount(); i++) {
+      checksum += cursor.dimension(i)->idAt(cursor.index(i)).size();
+    }
+    cursorCount++;
+  } while (!cursor.increment());
+  end = std::chrono::high_resolution_clock::now();
+  double cursorTime = std::chrono::duration<double>(end - start).count();
+
+  // Path generation
+  start = std::chrono::high_resolution_clock::now();
+  do {
+    checksum += ps.generateRelativeRunPath(currentIndeces).size();
+  } while (!ps.incrementIndeces(currentIndeces));
+  end = std::chrono::high_resolution_clock::now();
+  double mapPathTime = std::chrono::duration<double>(end - start).count();
+
+  start = std::chrono::high_resolution_clock::now();
+  do {
+    checksum += ps.relativeRunPath(cursor).size();
+  } while (!cursor.increment());
+  end = std::chrono::high_resolution_clock::now();
+  double cursorPathTime = std::chrono::duration<double>(end - start).count();
+
+  std::cout << "Samples: " << count << " (map) " << cursorCount << " (cursor)"
+            << std::endl;
+  std::cout << "Traversal map: " << mapTime << " s cursor: " << cursorTime
+            << " s" << std::endl;
+  std::cout << "Path generation map: " << mapPathTime
+            << " s cursor: " << cursorPathTime << " s" << std::endl;
+  std::cout << "checksum " << checksum << std::endl;
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include "tinc/CppProcessor.hpp"
+#include "tinc/ParameterSpace.hpp"
+
+#include "al/io/al_File.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+int main() {
+  auto dimension1 = std::make_shared<tinc::ParameterSpaceDimension>("dim1");
+  auto dimension2 = std::make_shared<tinc::ParameterSpaceDimension>("dim2");
+  auto inner_param =
+      std::make_shared<tinc::ParameterSpaceDimension>("inner_param");
+
+  for (int i = 0; i < 8; i++) {
+    dimension1->push_back(i * 0.1, "L_" + std::to_string(i));
+  }
+  dimension1->type = tinc::ParameterSpaceDimension::MAPPED;
+
+  for (int i = 0; i < 8; i++) {
+    dimension2->push_back(10 + i * 0.1);
+  }
+  dimension2->type = tinc::ParameterSpaceDimension::INDEX;
+
+  for (int i = 0; i < 8; i++) {
+    inner_param->push_back(i);
+  }
+  inner_param->type = tinc::ParameterSpaceDimension::INTERNAL;
+
+  tinc::ParameterSpace ps;
+
+  ps.registerDimension(dimension1);
+  ps.registerDimension(dimension2);
+  ps.registerDimension(inner_param);
+
+  ps.rootPath = "data/";
+
+  // Each worker thread needs its own processor, as the configuration and
+  // running directory are set independently for every sample.
+  // hardware_concurrency() returns 0 when the count can't be determined
+  const unsigned int numWorkers =
+      std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::unique_ptr<tinc::CppProcessor>> processors;
+  std::vector<tinc::Processor *> processorPointers;
+  for (unsigned int i = 0; i < numWorkers; i++) {
+    processors.emplace_back(std::make_unique<tinc::CppProcessor>());
+    tinc::CppProcessor *processor = processors.back().get();
+    processor->processingFunction = [processor]() {
+      std::string text =
+          processor->configuration["dim1"].flagValueStr + " -- " +
+          std::to_string(processor->configuration["dim2"].flagValueInt) +
+          " -- " +
+          std::to_string(
+              processor->configuration["inner_param"].flagValueDouble);
+
+      std::ofstream f(processor->runningDirectory() + "output_" +
+                      std::to_string(
+                          processor->configuration["inner_param"]
+                              .flagValueDouble) +
+                      ".txt");
+      f << text << std::endl;
+      f.close();
+      return true;
+    };
+    processorPointers.push_back(processor);
+  }
+
+  ps.onSweepProcess = [&](std::map<std::string, size_t> currentIndeces,
+                          double progress) {
+    std::cout << "Progress: " << progress * 100 << "%" << std::endl;
+  };
+
+  // Now sweep the parameter space using all worker threads
+  ps.sweepParallel(processorPointers);
+
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include "tinc/CppProcessor.hpp"
+#include "tinc/ParameterSpace.hpp"
+
+#include <fstream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Shares a parameter sweep between several processes. The processes claim
+// chunks of the sweep from a queue file in the root path. This example forks
+// the worker processes, but any process that uses the same parameter space
+// and queue file can join the sweep, e.g. running this program several times.
+
+int main() {
+  auto dimension1 = std::make_shared<tinc::ParameterSpaceDimension>("dim1");
+  auto dimension2 = std::make_shared<tinc::ParameterSpaceDimension>("dim2");
+
+  for (int i = 0; i < 20; i++) {
+    dimension1->push_back(i, "L_" + std::to_string(i));
+  }
+  dimension1->type = tinc::ParameterSpaceDimension::MAPPED;
+
+  for (int i = 0; i < 20; i++) {
+    dimension2->push_back(i / 20.0);
+  }
+  dimension2->type = tinc::ParameterSpaceDimension::INTERNAL;
+
+  tinc::ParameterSpace ps;
+  ps.registerDimension(dimension1);
+  ps.registerDimension(dimension2);
+  ps.rootPath = "sharded_data/";
+
+  tinc::CppProcessor processor;
+  processor.processingFunction = [&]() {
+    std::ofstream f(processor.runningDirectory() + "output_" +
+                    std::to_string(
+                        processor.configuration["dim2"].flagValueDouble) +
+                    ".txt");
+    f << getpid() << std::endl;
+    f.close();
+    return true;
+  };
+
+  // Start from scratch each time the example is run. Otherwise a sweep that
+  // has already finished is not run again.
+  ps.resetShardedSweep(processor, "sweep_queue.bin");
+
+  const int numWorkers = 4;
+  for (int i = 0; i < numWorkers; i++) {
+    if (fork() == 0) {
+      bool ok = ps.sweepSharded(processor, "sweep_queue.bin", 8);
+      std::cout << "Worker " << getpid() << " done. ok: " << ok << std::endl;
+      return ok ? 0 : 1;
+    }
+  }
+  for (int i = 0; i < numWorkers; i++) {
+    wait(nullptr);
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include "tinc/ScriptProcessor.hpp"
+
+#include "al/io/al_File.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// This example runs many script processors from separate threads, each in its
+// own directory. Processors never change the application's working directory,
+// so the scripts run concurrently. The example checks that every directory
+// gets its own output and that the cache metadata is valid, so a second pass
+// computes nothing. It exits with a non-zero status on failure and is run by
+// ctest when examples are built.
+
+int main() {
+  const int numThreads = 16;
+  const int runsPerThread = 8;
+
+  std::string root = "processor_threads/";
+  // Remove results from earlier runs, as the run counts are appended to
+  al::Dir::removeRecursively(root);
+  al::Dir::make(root);
+  {
+    std::ofstream script(root + "work.sh");
+    script << "sleep 0.2\n"
+              "echo \"$1\" >> runs.txt\n"
+              "echo \"$1\" > output.txt\n";
+  }
+
+  std::vector<std::unique_ptr<tinc::ScriptProcessor>> processors;
+  for (int i = 0; i < numThreads; i++) {
+    processors.emplace_back(std::make_unique<tinc::ScriptProcessor>());
+    auto &processor = *processors.back();
+    processor.setCommand("/bin/sh");
+    processor.setScriptName("../work.sh");
+    processor.setOutputFileNames({"output.txt"});
+  }
+
+  auto runPass = [&](bool forceRecompute) {
+    std::atomic<int> failures{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++) {
+      threads.emplace_back([&, i]() {
+        auto &processor = *processors[i];
+        std::string directory = root + "dir_" + std::to_string(i) + "/";
+        processor.setRunningDirectory(directory);
+        processor.setOutputDirectory(directory);
+        for (int run = 0; run < runsPerThread; run++) {
+          if (!processor.process(forceRecompute && run == 0)) {
+            failures++;
+          }
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    return failures.load();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  int failures = runPass(true);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  // Serial execution would take numThreads * 0.2 seconds
+  std::cout << numThreads << " processors ran in " << seconds
+            << " s (serial: " << numThreads * 0.2 << " s)" << std::endl;
+
+  // Nothing needs recomputing now
+  failures += runPass(false);
+
+  int badDirectories = 0;
+  for (int i = 0; i < numThreads; i++) {
+    std::string directory = root + "dir_" + std::to_string(i) + "/";
+    std::ifstream runs(directory + "runs.txt");
+    std::string line;
+    int count = 0;
+    while (std::getline(runs, line)) {
+      count++;
+    }
+    if (count != 1) {
+      badDirectories++;
+    }
+  }
+  std::cout << "Failures: " << failures
+            << " Directories with unexpected runs: " << badDirectories
+            << std::endl;
+  return failures == 0 && badDirectories == 0 ? 0 : 1;
+}
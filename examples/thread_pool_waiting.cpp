@@ -0,0 +1,67 @@
+#include "tinc/ComputationChain.hpp"
+#include "tinc/CppProcessor.hpp"
+#include "tinc/ThreadPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+// Threads waiting for work on the shared ThreadPool only run the tasks they
+// wait for. This example waits on a chain while the same chain is queued on a
+// pool whose only thread is busy. If the waiting thread ran the queued chain,
+// it would block on the chain it is already processing. It also checks that
+// waiting for one processor doesn't run unrelated queued tasks. It exits with
+// a non-zero status on failure and is run by ctest when examples are built.
+
+int main() {
+  auto &pool = tinc::ThreadPool::shared();
+  pool.setSize(1);
+
+  // Abort instead of hanging if waiting deadlocks
+  std::thread watchdog([]() {
+    std::this_thread::sleep_for(std::chrono::seconds(20));
+    std::cout << "Timed out: waiting deadlocked" << std::endl;
+    std::_Exit(1);
+  });
+  watchdog.detach();
+
+  std::atomic<bool> release{false};
+  pool.submit([&release]() {
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  tinc::CppProcessor first("first");
+  tinc::CppProcessor second("second");
+  first.processingFunction = []() { return true; };
+  second.processingFunction = []() { return true; };
+  tinc::ComputationChain chain(tinc::ComputationChain::PROCESS_ASYNC, "chain");
+  chain << first << second;
+
+  auto queued = chain.processFuture();
+  bool ok = chain.process();
+
+  // Waiting for this processor must leave the unrelated task to the pool
+  std::atomic<bool> unrelatedDone{false};
+  std::atomic<bool> ranOnMainThread{false};
+  auto mainThread = std::this_thread::get_id();
+  pool.submit([&unrelatedDone, &ranOnMainThread, mainThread]() {
+    ranOnMainThread = std::this_thread::get_id() == mainThread;
+    unrelatedDone = true;
+  });
+  tinc::CppProcessor third("third");
+  third.processingFunction = []() { return true; };
+  ok &= third.processFuture().get().ok;
+
+  release = true;
+  ok &= queued.get().ok;
+  pool.waitUntil([&unrelatedDone]() { return unrelatedDone.load(); });
+
+  std::cout << "Chain ok: " << ok
+            << " Unrelated task run while waiting: " << ranOnMainThread
+            << std::endl;
+  return ok && !ranOnMainThread ? 0 : 1;
+}
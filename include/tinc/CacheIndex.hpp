@@ -0,0 +1,158 @@
+#ifndef CACHEINDEX_HPP
+#define CACHEINDEX_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Cache metadata for one output
+ */
+struct CacheIndexEntry {
+  std::string cacheKey; ///< Hash of the inputs that produced the output
+  int64_t writtenNs{0}; ///< Time the entry was written (ns since epoch)
+  double computeSeconds{0.0}; ///< Time it took to compute the output
+  uint64_t sizeBytes{0};       ///< Total size of files
+  int64_t accessedNs{0}; ///< Last time the entry was used (ns since epoch)
+  std::string processorId; ///< Id of the processor that wrote the entry
+  std::vector<std::string> files; ///< Output files
+};
+
+/**
+ * @brief The CacheIndex class stores cache metadata for all outputs below a
+ * root path in a single file
+ *
+ * The index file is an append-only log of binary records, each protected by
+ * a checksum. It is read once (memory mapped where available) on open() and
+ * lookups are served from memory. A record cut short by a crash is discarded
+ * on the next open(). The log is compacted when superseded records outnumber
+ * live entries.
+ *
+ * Several processes can write to the index of the same root path, e.g. when
+ * sharing a sweep. Writes hold an exclusive lock on a lock file next to the
+ * index, and first read the records other processes appended, or reload the
+ * log if another process compacted it. Lookups are served from memory, so
+ * they see entries from other processes after the next write. Only one
+ * process may write to an index on Windows.
+ *
+ * Paths below the root path are stored relative to it, so the cache can be
+ * moved with its data. Entries record size, compute time and last access of
+ * outputs, for CacheManager to decide what to evict.
+ */
+class CacheIndex {
+public:
+  CacheIndex() {}
+
+  ~CacheIndex() { close(); }
+
+  /**
+   * @brief Open or create the index for rootPath
+   * @return false if the index file can't be opened for writing
+   */
+  bool open(std::string rootPath);
+
+  void close();
+
+  bool isOpen();
+
+  std::string rootPath() { return mRootPath; }
+
+  /**
+   * @brief Find entry for output path
+   * @return false if path has no entry
+   */
+  bool find(const std::string &path, CacheIndexEntry &entry);
+
+  /**
+   * @brief Add or replace entry for output path
+   */
+  bool put(const std::string &path, const CacheIndexEntry &entry);
+
+  /**
+   * @brief Remove entry for output path
+   */
+  bool remove(const std::string &path);
+
+  /**
+   * @brief Record that the entry for path was used
+   *
+   * The access time is only written to the log if the stored one is older
+   * than touchInterval seconds, so repeated hits don't grow the log.
+   */
+  bool touch(const std::string &path);
+
+  void setTouchInterval(double seconds) { mTouchIntervalNs = seconds * 1e9; }
+
+  /**
+   * @brief Copy of all entries, with paths relative to the root path
+   */
+  std::vector<std::pair<std::string, CacheIndexEntry>> entries();
+
+  size_t size();
+
+  /**
+   * @brief Sum of sizeBytes of all entries
+   */
+  uint64_t totalBytes();
+
+  /**
+   * @brief Path as stored in the index, relative to the root path if it is
+   * below it
+   */
+  std::string relativePath(const std::string &path);
+
+  /**
+   * @brief Path of a stored path relative to the application's working
+   * directory
+   */
+  std::string fullPath(const std::string &storedPath);
+
+  /**
+   * @brief Rewrite the log with only the live entries
+   */
+  bool compact();
+
+  /**
+   * @brief Flush appended records to disk
+   */
+  bool sync();
+
+  /**
+   * @brief Name of the index file created in the root path
+   */
+  static std::string indexFileName() { return ".tinc_cache_index"; }
+
+  static int64_t nowNs();
+
+private:
+  bool load();
+  // Replays records appended after mLogSize. False if there are invalid ones
+  bool readLog();
+  // Brings entries up to date with the index file. Call with the file lock
+  bool refreshLocked();
+  bool openLog();
+  bool append(const std::string &record);
+  bool compactLocked();
+
+  std::mutex mLock;
+  std::string mRootPath;
+  std::string mIndexPath;
+  std::string mCurrentDirectory;
+  FILE *mFile{nullptr};
+  int mLockFile{-1};
+  uint64_t mLogSize{0}; // Bytes of the index file applied to mEntries
+  std::unordered_map<std::string, CacheIndexEntry> mEntries;
+  uint64_t mRecordCount{0};
+  uint64_t mTotalBytes{0};
+  int64_t mTouchIntervalNs{60000000000};
+};
+
+} // namespace tinc
+
+#endif // CACHEINDEX_HPP
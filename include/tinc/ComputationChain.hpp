@@ -6,18 +6,47 @@
 
 #include <mutex>
 #include <thread>
+#include <utility>
 
 namespace tinc {
 
+/**
+ * @brief The ComputationChain class runs a group of processors
+ *
+ * PROCESS_SERIAL runs processors in the order they were added, stopping at
+ * the first failure unless the processor has ignoreFail set. PROCESS_ASYNC
+ * runs all processors at the same time on the shared ThreadPool.
+ *
+ * PROCESS_DAG runs processors as soon as the processors they depend on have
+ * finished, on the shared ThreadPool, so independent branches overlap.
+ * Dependencies are declared with addDependency() or inferred when a file
+ * produced by one processor is the input file of another. If a processor
+ * fails, the processors that depend on it are skipped unless it has
+ * ignoreFail set.
+ */
 class ComputationChain : public Processor {
 public:
-  typedef enum { PROCESS_SERIAL, PROCESS_ASYNC } ChainType;
+  typedef enum { PROCESS_SERIAL, PROCESS_ASYNC, PROCESS_DAG } ChainType;
   ComputationChain(ChainType type = PROCESS_SERIAL, std::string id = "")
       : Processor(id), mType(type) {}
   ComputationChain(std::string id) : Processor(id), mType(PROCESS_SERIAL) {}
 
   void addProcessor(Processor &chain);
 
+  /**
+   * @brief Make processor wait for dependency in PROCESS_DAG chains
+   *
+   * Both processors must be added to the chain before calling process().
+   */
+  void addDependency(Processor &processor, Processor &dependency);
+
+  /**
+   * @brief Infer dependencies from output and input file names
+   *
+   * On by default. Only used in PROCESS_DAG chains.
+   */
+  void inferDependencies(bool infer) { mInferDependencies = infer; }
+
   bool process(bool forceRecompute = false);
 
   ComputationChain &operator<<(Processor &processor) {
@@ -26,9 +55,17 @@ public:
   }
   std::vector<Processor *> processors() { return mProcessors; }
 
+  ChainType type() { return mType; }
+
 private:
+  bool processAll(bool forceRecompute);
+  bool processGraph(bool forceRecompute);
+  bool buildGraph(std::vector<std::vector<size_t>> &successors,
+                  std::vector<size_t> &pending);
+
   std::vector<Processor *> mProcessors;
-  std::vector<ProcessorAsync *> mAsyncProcessesInternal;
+  std::vector<std::pair<Processor *, Processor *>> mDependencies;
+  bool mInferDependencies{true};
   std::mutex mChainLock;
   ChainType mType;
 };
@@ -1,14 +1,15 @@
 #ifndef DEFERREDCOMPUTATION_HPP
 #define DEFERREDCOMPUTATION_HPP
 
+#include <atomic>
 #include <condition_variable>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 #include "tinc/BufferManager.hpp"
+#include "tinc/ThreadPool.hpp"
 // -----------------------------------------
 
 namespace tinc {
@@ -18,11 +19,7 @@ class DeferredComputation : public BufferManager<DataType> {
 public:
   DeferredComputation(uint16_t size = 2) : BufferManager<DataType>(size) {}
 
-  ~DeferredComputation() {
-    if (mProcessingThread) {
-      mProcessingThread->join();
-    }
-  }
+  ~DeferredComputation() { waitUntilDone(); }
 
   //  template<typename ...ProcessParams>
   //  bool process(bool(*func)(std::shared_ptr<DataType>, ProcessParams... ),
@@ -80,23 +77,34 @@ public:
     return false;
   }
 
+  /**
+   * @brief Run process() on the shared ThreadPool
+   *
+   * Waits for the previous computation to finish first. func and params are
+   * copied, so they don't need to outlive the call.
+   */
   template <typename Function, typename... ProcessParams>
   void processAsync(Function &&func, ProcessParams &&... params) {
     std::unique_lock<std::mutex> lk(mThreadLock);
-    if (mProcessingThread) {
-      mProcessingThread->join();
-    }
-
-    std::unique_lock<std::mutex> lck(mAsyncMutex);
-    mProcessingThread = std::make_unique<std::thread>([&]() {
+    waitUntilDone();
+    mProcessing = true;
+    auto task = [this, func, params...]() {
+      process(func, params...);
       std::unique_lock<std::mutex> lck(mAsyncMutex);
-      mProcessing = true;
-      mAsyncSignal.notify_all();
-      process(std::forward<Function>(func),
-              std::forward<ProcessParams>(params)...);
       mProcessing = false;
-    });
-    mAsyncSignal.wait(lck); // Wait for thread to start
+      mAsyncSignal.notify_all(); // Signal computation done
+    };
+    ThreadPool::shared().submit(task, this);
+  }
+
+  /**
+   * @brief Wait for the computation started by processAsync()
+   *
+   * Runs the computation on the calling thread if no pool thread has
+   * started it yet. Doesn't run other pool tasks.
+   */
+  void waitUntilDone() {
+    ThreadPool::shared().waitUntil([this]() { return !mProcessing; }, {this});
   }
 
   std::mutex mAsyncMutex;
@@ -121,9 +129,7 @@ public:
 
 private:
   std::mutex mThreadLock;
-  // TODO allow multiple threads
-  std::shared_ptr<std::thread> mProcessingThread;
-  std::atomic<bool> mProcessing;
+  std::atomic<bool> mProcessing{false};
   std::mutex mProcessLock;
 };
 
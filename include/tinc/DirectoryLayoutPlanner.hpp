@@ -0,0 +1,71 @@
+#ifndef DIRECTORYLAYOUTPLANNER_HPP
+#define DIRECTORYLAYOUTPLANNER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Statistics reported by DirectoryLayoutPlanner
+ */
+struct DirectoryLayoutStats {
+  uint64_t pathsProcessed{0};
+  uint64_t directoriesCreated{0};
+  uint64_t directoriesExisting{0};
+  double seconds{0.0};
+};
+
+/**
+ * @brief The DirectoryLayoutPlanner class creates a directory tree from a
+ * stream of relative paths
+ *
+ * Paths are fed one at a time through addPath(). The planner keeps the chain
+ * of directories of the previous path open, and only creates the components
+ * that differ from it, relative to the open parent directory. Feeding paths
+ * depth first (deepest component changing fastest) creates each shared prefix
+ * only once.
+ */
+class DirectoryLayoutPlanner {
+public:
+  DirectoryLayoutPlanner() {}
+
+  ~DirectoryLayoutPlanner() { end(); }
+
+  /**
+   * @brief Start a layout below rootPath.
+   * @return false if root path can't be created or opened
+   */
+  bool begin(std::string rootPath);
+
+  /**
+   * @brief Create all directories in relativePath that don't exist.
+   * @return false if a directory can't be created
+   */
+  bool addPath(const std::string &relativePath);
+
+  /**
+   * @brief Close all open directories and finish timing.
+   */
+  void end();
+
+  DirectoryLayoutStats stats() const { return mStats; }
+
+private:
+  void closeFrom(size_t depth);
+
+  std::string mRootPath;
+  int mRootFd{-1};
+  bool mActive{false};
+  std::vector<std::string> mComponents;
+  std::vector<int> mFds;
+  std::vector<std::string> mNewComponents;
+  DirectoryLayoutStats mStats;
+  std::chrono::steady_clock::time_point mStartTime;
+};
+
+} // namespace tinc
+
+#endif // DIRECTORYLAYOUTPLANNER_HPP
@@ -0,0 +1,107 @@
+#ifndef FILEHASHER_HPP
+#define FILEHASHER_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace tinc {
+
+/**
+ * @brief Incremental 64 bit hash of a byte stream (XXH64)
+ *
+ * Fast, non cryptographic hash used to build cache keys. The result is
+ * identical to XXH64 from the xxHash library for the same seed.
+ */
+class HashState {
+public:
+  HashState(uint64_t seed = 0) { reset(seed); }
+
+  void reset(uint64_t seed = 0);
+
+  void update(const void *data, size_t size);
+  void update(const std::string &data) { update(data.data(), data.size()); }
+  void update(uint64_t value);
+
+  uint64_t digest() const;
+
+  /**
+   * @brief Hash a buffer in one call
+   */
+  static uint64_t hash(const void *data, size_t size, uint64_t seed = 0);
+
+  /**
+   * @brief 16 character hexadecimal representation of a hash
+   */
+  static std::string toHex(uint64_t hash);
+
+private:
+  uint64_t mAcc[4];
+  uint64_t mSeed;
+  uint64_t mTotalSize;
+  unsigned char mBuffer[32];
+  size_t mBufferSize;
+};
+
+/**
+ * @brief The FileHasher class hashes file contents and remembers the result
+ *
+ * Hashes are memoised by file identity (device and inode), size and
+ * modification time in nanoseconds, so a file is only read again when it
+ * changes. Files modified less than a second before they were hashed are not
+ * memoised, as a write within the file system's timestamp resolution would
+ * go unnoticed. All functions are thread safe.
+ */
+class FileHasher {
+public:
+  /**
+   * @brief Hash of the contents of file at path
+   * @return false if the file can't be read
+   */
+  bool fileHash(const std::string &path, uint64_t &hash);
+
+  /**
+   * @brief Forget all memoised hashes
+   */
+  void clear();
+
+  size_t memoSize();
+
+  /**
+   * @brief Maximum number of memoised files. The memo is cleared when full.
+   */
+  void setMaxMemoSize(size_t size) { mMaxMemoSize = size; }
+
+  /**
+   * @brief Process wide instance shared by all processors
+   */
+  static FileHasher &shared();
+
+private:
+  struct FileId {
+    uint64_t device;
+    uint64_t inode;
+    bool operator==(const FileId &other) const {
+      return device == other.device && inode == other.inode;
+    }
+  };
+  struct FileIdHash {
+    size_t operator()(const FileId &id) const {
+      return std::hash<uint64_t>()(id.inode ^ (id.device << 32));
+    }
+  };
+  struct FileState {
+    uint64_t size;
+    int64_t modifiedNs;
+    uint64_t hash;
+  };
+
+  std::mutex mMemoLock;
+  std::unordered_map<FileId, FileState, FileIdHash> mMemo;
+  size_t mMaxMemoSize{1 << 20};
+};
+
+} // namespace tinc
+
+#endif // FILEHASHER_HPP
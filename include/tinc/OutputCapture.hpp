@@ -0,0 +1,105 @@
+#ifndef OUTPUTCAPTURE_HPP
+#define OUTPUTCAPTURE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+enum CaptureStream { CAPTURE_OUTPUT = 0, CAPTURE_ERROR = 1 };
+
+/**
+ * @brief The OutputCapture class collects the output of a process with
+ * bounded memory
+ *
+ * Data for standard output and error is kept in one ring buffer per stream,
+ * so only the last bufferSize bytes of each are held. Complete lines are
+ * passed to the line callback as they arrive, and all data can be written
+ * to a spill file in arrival order.
+ */
+class OutputCapture {
+public:
+  OutputCapture(size_t bufferSize = 1 << 20);
+
+  ~OutputCapture() { finish(); }
+
+  OutputCapture(const OutputCapture &) = delete;
+  OutputCapture &operator=(const OutputCapture &) = delete;
+
+  /**
+   * @brief Set function called for every line, without the line ending
+   *
+   * Lines longer than the buffer size are passed in pieces.
+   */
+  void setLineCallback(
+      std::function<void(const std::string &line, CaptureStream stream)>
+          callback) {
+    mLineCallback = callback;
+  }
+
+  /**
+   * @brief Write all captured data to file at path
+   * @return false if the file can't be opened
+   */
+  bool setSpillFile(const std::string &path);
+
+  /**
+   * @brief Copy data to std::cout or std::cerr as it arrives
+   */
+  void setEcho(bool output, bool error) {
+    mEcho[CAPTURE_OUTPUT] = output;
+    mEcho[CAPTURE_ERROR] = error;
+  }
+
+  void append(CaptureStream stream, const char *data, size_t size);
+
+  /**
+   * @brief Pass unterminated last lines to the callback and close spill file
+   */
+  void finish();
+
+  /**
+   * @brief Data held for stream. Only the end if truncated()
+   */
+  std::string contents(CaptureStream stream) const;
+
+  /**
+   * @brief Total bytes received on all streams
+   */
+  uint64_t totalSize() const {
+    return mStreams[CAPTURE_OUTPUT].total + mStreams[CAPTURE_ERROR].total;
+  }
+
+  /**
+   * @brief True if data was dropped from a ring buffer
+   */
+  bool truncated() const {
+    return mStreams[CAPTURE_OUTPUT].truncated ||
+           mStreams[CAPTURE_ERROR].truncated;
+  }
+
+private:
+  struct Stream {
+    std::vector<char> ring;
+    size_t start{0};
+    size_t size{0};
+    uint64_t total{0};
+    bool truncated{false};
+    std::string line;
+  };
+
+  void splitLines(CaptureStream stream, const char *data, size_t size);
+
+  size_t mBufferSize;
+  Stream mStreams[2];
+  bool mEcho[2]{false, false};
+  std::function<void(const std::string &, CaptureStream)> mLineCallback;
+  FILE *mSpillFile{nullptr};
+};
+
+} // namespace tinc
+
+#endif // OUTPUTCAPTURE_HPP
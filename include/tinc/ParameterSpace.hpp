@@ -1,18 +1,105 @@
 #ifndef PARAMETERSPACE_HPP
 #define PARAMETERSPACE_HPP
 
+#include "tinc/DirectoryLayoutPlanner.hpp"
 #include "tinc/ParameterSpaceDimension.hpp"
 #include "tinc/Processor.hpp"
+#include "tinc/SweepCursor.hpp"
+#include "tinc/SweepJournal.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace tinc {
 
+class ComputationChain;
+
+/**
+ * @brief Handle to a parameter space sweep running in the background
+ *
+ * Returned by ParameterSpace::sweepAsync(). The sweep runs in threads within
+ * the current process and can be queried for progress, paused, resumed,
+ * cancelled and joined.
+ */
+class SweepHandle {
+  friend class ParameterSpace;
+
+public:
+  ~SweepHandle();
+
+  /**
+   * @brief Fraction of samples completed (0.0 to 1.0)
+   */
+  double progress();
+
+  uint64_t completedCount() { return mCompleted; }
+  uint64_t totalCount() { return mTotal; }
+
+  /**
+   * @brief Stop sweep after samples currently being processed are done
+   */
+  void cancel();
+
+  /**
+   * @brief Stop taking new samples until resume() is called
+   */
+  void pause();
+  void resume();
+  bool paused();
+
+  /**
+   * @brief Returns true while sweep has not finished
+   */
+  bool running() { return mRunning; }
+
+  /**
+   * @brief Wait for sweep to finish
+   * @return true if all samples were processed successfully
+   */
+  bool join();
+
+protected:
+  // Blocks while paused. Returns false if sweep has been cancelled
+  bool waitIfPaused();
+
+  std::atomic<uint64_t> mCompleted{0};
+  std::atomic<uint64_t> mTotal{1};
+  std::atomic<bool> mCancelled{false};
+  std::atomic<bool> mRunning{false};
+  std::atomic<bool> mSuccess{false};
+
+  bool mPaused{false};
+  std::mutex mPauseLock;
+  std::condition_variable mPauseSignal;
+
+  std::thread mThread;
+  std::mutex mJoinLock;
+};
+
 class ParameterSpace {
+  // Default path generator. Places the id of each dimension in its own
+  // directory level.
+  struct DefaultRunPathGenerator {
+    ParameterSpace *space;
+    std::string operator()(std::map<std::string, size_t> indeces) const;
+  };
+
+  // Wraps generators set through setRunPathGenerator()
+  struct DeclaredRunPathGenerator {
+    std::function<std::string(std::map<std::string, size_t>)> generator;
+    std::string operator()(std::map<std::string, size_t> indeces) const {
+      return generator(indeces);
+    }
+  };
+
 public:
   ParameterSpace();
 
@@ -62,20 +149,215 @@ public:
    */
   bool incrementIndeces(std::map<std::string, size_t> &currentIndeces);
 
+  /**
+   * @brief Create a cursor to traverse the dimensions provided
+   * @param dimensionNames dimensions to traverse. All dimensions if empty
+   *
+   * Dimensions are ordered by name, so the cursor traverses the space in the
+   * same order as incrementIndeces(). Dimensions not found are skipped.
+   */
+  SweepCursor createCursor(std::vector<std::string> dimensionNames = {});
+
+  /**
+   * @brief Get relative filesystem path for cursor position
+   *
+   * Equivalent to generateRelativeRunPath(cursor.toMap()), but avoids the map
+   * conversion and name lookups when the default path generator is used.
+   */
+  std::string relativeRunPath(const SweepCursor &cursor);
+
+  /**
+   * @brief Set function to generate relative run paths, declaring the
+   * dimensions the paths depend on.
+   * @param generator function that generates path from dimension indeces
+   * @param dependencies names of dimensions that affect the path.
+   *
+   * Paths are cached by the position of the dependencies, so the generator
+   * is called only once for each combination. The cache is cleared when the
+   * values or ids of a dependency change. Setting generateRelativeRunPath
+   * directly disables the cache. Dependencies that are not registered are
+   * reported here and ignored.
+   */
+  void setRunPathGenerator(
+      std::function<std::string(std::map<std::string, size_t>)> generator,
+      std::vector<std::string> dependencies);
+
+  void clearRunPathCache();
+
+  /**
+   * @brief Number of samples in the space formed by dimensionNames
+   * @param dimensionNames All dimensions if empty
+   */
+  uint64_t sampleCount(std::vector<std::string> dimensionNames = {});
+
+  /**
+   * @brief Encode indeces as a position in the flattened space
+   *
+   * Uses the same order as incrementIndeces(), i.e. incrementing the linear
+   * index is equivalent to calling incrementIndeces().
+   */
+  uint64_t linearIndex(std::map<std::string, size_t> &indeces);
+
+  /**
+   * @brief Decode position in flattened space formed by dimensionNames
+   * @param linearIndex
+   * @param dimensionNames All dimensions if empty
+   * @return indeces for linearIndex. Empty if linearIndex is out of range.
+   */
+  std::map<std::string, size_t>
+  indecesForLinearIndex(uint64_t linearIndex,
+                        std::vector<std::string> dimensionNames = {});
+
   void sweep(Processor &processor, std::vector<std::string> dimensionNames = {},
              bool recompute = false);
 
-  void sweepAsync(Processor &processor,
+  /**
+   * @brief sweep a range of the parameter space
+   * @param begin first linear index to process
+   * @param end linear index after last one to process
+   *
+   * Linear indeces are described in linearIndex(). Splitting the total
+   * sampleCount() into ranges allows sharing a sweep across processes or
+   * machines, or resuming at a particular sample.
+   */
+  void sweepRange(Processor &processor, uint64_t begin, uint64_t end,
                   std::vector<std::string> dimensionNames = {},
                   bool recompute = false);
 
+  /**
+   * @brief sweep a range of the parameter space using one worker thread per
+   * processor
+   */
+  void sweepRange(std::vector<Processor *> processors, uint64_t begin,
+                  uint64_t end, std::vector<std::string> dimensionNames = {},
+                  bool recompute = false);
+
+  /**
+   * @brief sweep the parameter space recording progress in a journal
+   * @param journalFile journal file, relative to rootPath
+   * @return true if the sweep was not aborted by a processor failure
+   *
+   * Samples recorded as completed in the journal by a previous call are
+   * skipped, so an interrupted sweep resumes where it stopped and only
+   * retries failed or missing samples. Failures ignored through
+   * Processor::ignoreFail are recorded and retried on the next call. If
+   * recompute is true, all samples are processed, and still recorded in the
+   * journal. A journal written for another processor or for different
+   * dimension values is discarded. See SweepJournal.
+   */
+  bool sweepResumable(Processor &processor,
+                      std::string journalFile = "sweep_journal.bin",
+                      std::vector<std::string> dimensionNames = {},
+                      bool recompute = false);
+
+  /**
+   * @brief sweep the parameter space cooperatively with other processes
+   * @param queueFile work queue file, relative to rootPath
+   * @param chunkSize number of samples claimed at a time
+   * @return true if the sweep completed with no failures in this process
+   *
+   * Any number of processes on the same host can call this function with the
+   * same parameter space and queueFile. Each process claims chunks of the
+   * sweep from the queue until none are left, then waits for chunks claimed
+   * by other processes to complete. Chunks claimed by processes that die are
+   * reassigned. See SweepWorkQueue.
+   *
+   * The queue file name gets a suffix that identifies the processor id and
+   * the names, values and ids of the dimensions swept, so a different sweep
+   * with the same rootPath and queueFile uses its own queue. A finished
+   * sweep is not run again until resetShardedSweep() is called.
+   */
+  bool sweepSharded(Processor &processor,
+                    std::string queueFile = "sweep_queue.bin",
+                    uint64_t chunkSize = 16,
+                    std::vector<std::string> dimensionNames = {},
+                    bool recompute = false);
+
+  /**
+   * @brief Remove the work queue of a sweep started with sweepSharded()
+   *
+   * Must not be called while processes are running the sweep.
+   */
+  bool resetShardedSweep(Processor &processor,
+                         std::string queueFile = "sweep_queue.bin",
+                         std::vector<std::string> dimensionNames = {});
+
+  /**
+   * @brief sweep the parameter space using multiple worker threads
+   * @param processors one processor per worker thread
+   * @param dimensionNames dimensions to sweep. All dimensions if empty
+   * @param recompute force recompute even if processor has cached results
+   *
+   * The number of workers is the number of processors passed. Each processor
+   * must be a separate instance, as each worker writes its own configuration
+   * and running directory before calling process(). onSweepProcess is called
+   * from the worker threads, but calls are serialized and progress is
+   * reported in completion order.
+   */
+  void sweepParallel(std::vector<Processor *> processors,
+                     std::vector<std::string> dimensionNames = {},
+                     bool recompute = false);
+
+  /**
+   * @brief sweep the parameter space overlapping the stages of a chain
+   * @param chain PROCESS_SERIAL chain. Each of its processors is a stage
+   * @param queueSize maximum samples waiting between two stages
+   * @return true if the sweep was not aborted by a failure
+   *
+   * Stage n works on sample k while stage n + 1 works on sample k - 1, so a
+   * sweep of an N stage chain approaches the throughput of its slowest stage
+   * instead of the sum of all. Each stage processes samples in sweep order on
+   * the shared ThreadPool and receives the configuration and running
+   * directory of its sample, so stages must be separate instances. As in a
+   * serial chain, a failing stage skips the rest of the chain for that sample
+   * unless it has ignoreFail set, and the sweep is aborted unless the chain
+   * has ignoreFail set. onSweepProcess is called in sweep order. The chain's
+   * prepareFunction is called on the calling thread as each sample enters
+   * the pipeline. The chain's process() is not called, but its done
+   * callbacks are called for each sample that went through the chain, in
+   * sweep order, as in a serial chain.
+   */
+  bool sweepPipelined(ComputationChain &chain,
+                      std::vector<std::string> dimensionNames = {},
+                      bool recompute = false, size_t queueSize = 4);
+
+  /**
+   * @brief sweep the parameter space in a background thread
+   * @return handle to query progress, pause, cancel or join the sweep
+   *
+   * The sweep runs within the current process. stopSweep() cancels and joins
+   * all sweeps started this way.
+   */
+  std::shared_ptr<SweepHandle>
+  sweepAsync(Processor &processor, std::vector<std::string> dimensionNames = {},
+             bool recompute = false);
+
+  /**
+   * @brief sweep the parameter space in the background using one worker
+   * thread per processor.
+   *
+   * See sweepParallel()
+   */
+  std::shared_ptr<SweepHandle>
+  sweepAsync(std::vector<Processor *> processors,
+             std::vector<std::string> dimensionNames = {},
+             bool recompute = false);
+
   /**
    * @brief Create necessary filesystem directories to be populated by data
+   * @param stats if not null, filled with number of directories created and
+   * time taken.
    * @return true if successfully created (or checked existence) of
    * directories.
+   *
+   * Directories are created depth first, walking the parameter space without
+   * generating the full list of paths.
    */
-  bool createDataDirectories();
+  bool createDataDirectories(DirectoryLayoutStats *stats = nullptr);
 
+  /**
+   * @brief Cancel all running sweeps and wait for asynchronous sweeps to end
+   */
   void stopSweep();
 
   /**
@@ -86,9 +368,25 @@ public:
    * The file is loaded relative to 'rootPath'. Dimension found in the file are
    * added to the current parameter space if a dimension with that name already
    * exists, it is replaced.
+   *
+   * Subdirectories containing their own parameter space file are listed from
+   * the manifest written by writeSpecialDirectoriesManifest() if present,
+   * otherwise the directory tree below rootPath is scanned.
    */
   bool readFromNetCDF(std::string ncFile = "parameter_space.nc");
 
+  /**
+   * @brief Write list of subdirectories containing a parameter space file.
+   * @param ncFile name of parameter space files
+   * @return false if the manifest can't be written
+   *
+   * The manifest is written next to the root ncFile as ncFile + ".manifest"
+   * and avoids scanning the directory tree in readFromNetCDF(). It must be
+   * rewritten (or removed) when parameter space files are added or removed.
+   */
+  bool
+  writeSpecialDirectoriesManifest(std::string ncFile = "parameter_space.nc");
+
   /**
    * @brief write parameter sapce dimensions to netCDF file.
    * @param fileName
@@ -124,40 +422,82 @@ public:
   // the other similar functionality in setOuputFilename(), perhaps an output
   // filename generator function should be provided?
   std::function<std::string(std::map<std::string, size_t>)>
-      generateRelativeRunPath = [&](std::map<std::string, size_t> indeces) {
-        std::string path;
-        for (auto dimensionSample : indeces) {
-          std::shared_ptr<ParameterSpaceDimension> dimension;
-
-          for (auto ps : dimensions) {
-            if (ps->parameter().getName() == dimensionSample.first) {
-              dimension = ps;
-              break;
-            }
-          }
-          if (dimension) {
-            auto id = dimension->idAt(dimensionSample.second);
-            path += id + "/";
-          }
-        }
-        return path;
-      };
+      generateRelativeRunPath = DefaultRunPathGenerator{this};
 
   std::function<void(std::map<std::string, size_t> currentIndeces,
                      double progress)>
       onSweepProcess;
 
+  /**
+   * @brief Defer loading values and ids of dimensions read from NetCDF files
+   * until they are first accessed.
+   *
+   * Dimensions with fewer elements than lazyLoadMinimumSize are always loaded
+   * immediately.
+   */
+  bool lazyLoadDimensions{false};
+  size_t lazyLoadMinimumSize{1 << 16};
+
   bool readDimensionsInNetCDFFile(
       std::string filename,
       std::vector<std::shared_ptr<ParameterSpaceDimension>> &newDimensions);
 
 protected:
+  /**
+   * @brief Set processor configuration and running directory for a sample
+   * @param processor
+   * @param cursor position of the sample in the parameter space
+   */
+  void prepareProcessor(Processor &processor, const SweepCursor &cursor);
+
   std::function<void(float oldValue, ParameterSpaceDimension *changedDimension)>
       mChangeCallback = [](float, ParameterSpaceDimension *) {};
 
-  std::unique_ptr<std::thread> mAsyncProcessingThread;
-
-  bool mSweepRunning{false};
+  // Runs the sweep on the calling thread for a single processor, or on one
+  // worker thread per processor otherwise. Processes linear indeces in range
+  // [begin, end). If journal is provided, samples done are skipped and
+  // results are recorded.
+  bool runSweep(std::vector<Processor *> processors,
+                std::vector<std::string> dimensionNames, bool recompute,
+                SweepHandle &handle, uint64_t begin = 0,
+                uint64_t end = std::numeric_limits<uint64_t>::max(),
+                SweepJournal *journal = nullptr);
+
+  // Hash of processor id and the dimensions swept, used by sweepSharded()
+  // to tell sweeps apart
+  uint64_t sweepIdentity(Processor &processor,
+                         std::vector<std::string> dimensionNames);
+
+  // Returns path from cache for generators set with setRunPathGenerator().
+  // getIndex provides the index for each dependency dimension.
+  bool cachedRunPath(std::function<size_t(ParameterSpaceDimension *)> getIndex,
+                     std::function<std::map<std::string, size_t>()> getIndeces,
+                     std::string &path);
+
+  // Find dimensions for mRunPathDependencies. Must hold mRunPathLock
+  void resolveRunPathDependencies(bool reportMissing);
+
+  std::mutex mRunPathLock;
+  std::vector<std::string> mRunPathDependencies;
+  bool mRunPathDependenciesResolved{false};
+  std::vector<ParameterSpaceDimension *> mRunPathDependencyDimensions;
+  std::vector<uint64_t> mRunPathDependencyVersions; // When cache was filled
+  std::unordered_map<uint64_t, std::string> mRunPathCache;
+  size_t mRunPathCacheMaxSize{1 << 16};
+  // For default generator. The cursor is recreated only when the filesystem
+  // dimensions change.
+  RunPathBuilder mCurrentRunPathBuilder;
+  SweepCursor mCurrentRunPathCursor;
+  std::vector<ParameterSpaceDimension *> mCurrentRunPathDimensions;
+
+  std::mutex mSweepsLock;
+  std::vector<SweepHandle *> mActiveSweeps; // Sweeps that stopSweep() cancels
+  std::vector<std::shared_ptr<SweepHandle>> mAsyncSweeps;
+
+  // Fill mSpecialDirs by scanning directories below rootPath up to the depth
+  // of the run paths
+  void scanSpecialDirectories(std::string ncFile);
+  bool readSpecialDirectoriesManifest(std::string ncFile);
 
   // Subdirectories that have a parameter space file in them.
   std::map<std::string, std::string> mSpecialDirs;
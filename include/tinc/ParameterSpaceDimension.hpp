@@ -7,8 +7,13 @@
 #undef far
 #endif
 
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -16,6 +21,41 @@
 
 namespace tinc {
 
+/**
+ * @brief Non owning reference to an id stored in a ParameterSpaceDimension
+ *
+ * Only valid until the dimension is modified.
+ */
+struct IdView {
+  const char *data{""};
+  size_t size{0};
+
+  std::string str() const { return std::string(data, size); }
+  bool operator==(const std::string &other) const {
+    return other.size() == size && other.compare(0, size, data, size) == 0;
+  }
+  bool operator!=(const std::string &other) const { return !(*this == other); }
+};
+
+/**
+ * @brief The IdStorage class stores strings contiguously in a single buffer
+ */
+class IdStorage {
+public:
+  size_t size() const { return mOffsets.size() - 1; }
+  void reserve(size_t count, size_t totalLength = 0);
+  void clear();
+  void push_back(const std::string &id);
+  void push_back(const char *id, size_t length);
+  IdView at(size_t i) const {
+    return IdView{mBuffer.data() + mOffsets[i], mOffsets[i + 1] - mOffsets[i]};
+  }
+
+private:
+  std::vector<char> mBuffer;
+  std::vector<size_t> mOffsets{0};
+};
+
 /**
  * @brief The ParameterSpaceDimension class maps parameter values to string ids
  *
@@ -36,6 +76,9 @@ public:
 
   ParameterSpaceDimension(std::string name, std::string group = "")
       : mParameterValue(name, group) {}
+
+  ~ParameterSpaceDimension();
+
   std::string getName();
 
   // Access to current
@@ -63,8 +106,17 @@ public:
   float at(size_t x);
 
   std::string idAt(size_t x);
+
+  // Reference to id without copying. If the dimension has no ids, the
+  // formatted values used as ids are cached on first use.
+  IdView idViewAt(size_t x);
+
   size_t getIndexForValue(float value);
 
+  // Returns size() if id is not found. If ids are repeated, the first
+  // index is returned
+  size_t getIndexForId(const std::string &id);
+
   // FIXME Are these getAll still relevant?
   std::vector<std::string> getAllIds(float value);
   std::vector<size_t> getAllIndeces(float value);
@@ -91,6 +143,10 @@ public:
   void sort();
   void clear();
 
+  // Returns true if values are known to be in ascending order. Lookups by
+  // value use binary search when this is true.
+  bool isSorted() { return mSorted; }
+
   // There is no check to see if value is already present. Could cause trouble
   // if value is there already.
   void push_back(float value, std::string id = "");
@@ -103,6 +159,39 @@ public:
   // Set limits from internal data
   void conform();
 
+  /**
+   * @brief Set function to load values and ids on first access.
+   * @param size number of values the loader will provide
+   * @param loader fills values and ids. ids can be left empty.
+   *
+   * Current values and ids are discarded. size() reports the size given here
+   * without loading the data. All other accessors load the data on first use,
+   * and the parameter's limits are set once data has been loaded.
+   */
+  void
+  setLoader(size_t size,
+            std::function<bool(std::vector<float> &, IdStorage &)> loader);
+
+  /**
+   * @brief Set loader, publishing the limits of the values it will provide
+   *
+   * The parameter's limits are set to min and max right away, so they are
+   * available before the data is loaded.
+   */
+  void setLoader(size_t size,
+                 std::function<bool(std::vector<float> &, IdStorage &)> loader,
+                 float min, float max);
+
+  // False if the data from the loader has not been loaded yet
+  bool isLoaded() { return mLoaded.load(); }
+
+  /**
+   * @brief Counter incremented whenever values or ids change
+   *
+   * Allows caches of data derived from the dimension to detect stale entries.
+   */
+  uint64_t version() { return mVersion.load(); }
+
   void addConnectedParameterSpace(ParameterSpaceDimension *paramSpace);
 
   // Protect parameter space (to avoid access during modification)
@@ -114,12 +203,62 @@ public:
   DimensionType type{INTERNAL};
 
 private:
+  // Maps ids to integer codes. A single table is used by all dimensions, so
+  // codes can be compared across any pair of connected dimensions. Ids are
+  // only added for dimensions that have connected spaces. The table is
+  // emptied once no dimension holds codes, so it only keeps growing while
+  // some dimension's codes stay valid as other dimensions change.
+  struct IdCodeTable {
+    std::mutex lock;
+    std::unordered_map<std::string, uint32_t> codes;
+    size_t holders{0}; // Dimensions with valid codes
+    uint32_t code(const std::string &id);
+    void acquire();
+    void release();
+    static IdCodeTable &shared();
+  };
+
+  // Integer codes for the ids at indeces [begin, end), computed on demand
+  std::vector<uint32_t> idCodes(size_t begin, size_t end);
+
+  void ensureLoaded() {
+    if (!mLoaded.load(std::memory_order_acquire)) {
+      load();
+    }
+  }
+  void load();
+
+  template <typename DataType>
+  void appendValues(DataType *values, size_t count, std::string idprefix);
+
+  // Must be called whenever mValues or mIds change outside of
+  // push_back(), append(), sort() and clear()
+  void dataChanged();
+
   // Data
   std::vector<float> mValues;
-  std::vector<std::string> mIds;
+  IdStorage mIds;
 
   std::mutex mLock;
 
+  // Deferred loading
+  std::function<bool(std::vector<float> &, IdStorage &)> mLoader;
+  size_t mLoaderSize{0};
+  std::atomic<bool> mLoaded{true};
+  std::mutex mLoadLock;
+
+  // Lookup structures
+  std::atomic<uint64_t> mVersion{0};
+  bool mSorted{true};
+  bool mIdIndexValid{false};
+  std::unordered_map<std::string, size_t> mIdIndex;
+  std::mutex mIdIndexLock;
+  bool mIdCodesValid{false};
+  std::vector<uint32_t> mIdCodes;
+  bool mFormattedIdsValid{false};
+  IdStorage mFormattedIds; // Ids generated from values when mIds is empty
+  std::mutex mFormattedIdsLock;
+
   // Current state
   al::Parameter mParameterValue;
 
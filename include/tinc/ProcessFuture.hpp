@@ -0,0 +1,107 @@
+#ifndef PROCESSFUTURE_HPP
+#define PROCESSFUTURE_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+class Processor;
+
+/**
+ * @brief Outcome of an asynchronous process() call
+ */
+struct ProcessResult {
+  bool ok{false};
+  double seconds{0.0};     ///< Wall clock time of the call
+  std::string error;       ///< Reason for failure, empty if ok
+  std::string processorId; ///< Id of the processor, empty for continuations
+};
+
+/**
+ * @brief The ProcessFuture class is a handle to a result computed on the
+ * shared ThreadPool
+ *
+ * Copies of a ProcessFuture refer to the same result. Continuations added
+ * with then() run on the pool when the result is ready, so work can be
+ * chained without a thread blocking on each step.
+ *
+ * get() only runs tasks of the future it waits for and of the futures that
+ * one depends on, so it is safe to call while holding locks that unrelated
+ * pool tasks need.
+ */
+class ProcessFuture {
+public:
+  /**
+   * @brief Create an invalid future
+   */
+  ProcessFuture() {}
+
+  bool valid() const { return mState != nullptr; }
+
+  /**
+   * @brief True if the result is available
+   */
+  bool ready() const;
+
+  /**
+   * @brief Wait for the result
+   *
+   * Work for this future and the futures it depends on that no pool thread
+   * has started yet runs on the calling thread.
+   */
+  ProcessResult get() const;
+
+  /**
+   * @brief Run continuation with the result of this future
+   *
+   * The continuation runs whether this future succeeded or not. An invalid
+   * future is passed to it as failed. Its return value and run time make the
+   * result of the returned future.
+   */
+  ProcessFuture then(std::function<bool(const ProcessResult &)> continuation);
+
+  /**
+   * @brief Run processor after this future succeeds
+   *
+   * If this future fails or is invalid, processor is skipped and the returned
+   * future fails with the same error.
+   */
+  ProcessFuture then(Processor &processor, bool forceRecompute = false);
+
+  /**
+   * @brief Future that completes when all futures have completed
+   *
+   * It succeeds if all succeed. Its time is the sum of their times and its
+   * error lists their errors, one per line.
+   */
+  static ProcessFuture whenAll(std::vector<ProcessFuture> futures);
+
+  /**
+   * @brief Queue processor->process() on the shared ThreadPool
+   */
+  static ProcessFuture run(Processor &processor, bool forceRecompute = false);
+
+  /**
+   * @brief Future that already holds result
+   */
+  static ProcessFuture completed(ProcessResult result);
+
+private:
+  struct State;
+
+  // Calls callback on the pool once the result is available, as a task of
+  // group
+  void onDone(std::function<void(const ProcessResult &)> callback,
+              const void *group) const;
+  static void complete(const std::shared_ptr<State> &state,
+                       ProcessResult result);
+
+  std::shared_ptr<State> mState;
+};
+
+} // namespace tinc
+
+#endif // PROCESSFUTURE_HPP
@@ -3,12 +3,19 @@
 
 #include "al/scene/al_PolySynth.hpp"
 
+#include "tinc/ProcessFuture.hpp"
+
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace tinc {
 
 // TODO move PushDirectory to allolib? Or its own file?
+// PushDirectory changes the working directory of the whole application while
+// in scope. Processors don't use it, they resolve their files through
+// pathInDirectory() instead.
 class PushDirectory {
 public:
   PushDirectory(std::string directory, bool verbose = false);
@@ -82,10 +89,25 @@ struct Flag {
   double flagValueDouble;
 };
 
+/**
+ * @brief Counters and change to result latency of coalesced processing
+ */
+struct CoalescingStats {
+  uint64_t changes{0};     ///< Parameter changes received
+  uint64_t runs{0};        ///< Calls to process()
+  uint64_t cancelled{0};   ///< Runs cancelled because of a newer change
+  uint64_t results{0};     ///< Runs whose result reflects the latest change
+  double lastSeconds{0.0}; ///< Time from last change to its result
+  double meanSeconds{0.0};
+  double maxSeconds{0.0};
+};
+
 // You must call prepareFunction(), callDoneCallbacks() and test for 'enabled'
 // within the process() function of all child classes. ( Should we wrap this to
 // avoid user error here? )
 class Processor {
+  friend class ParameterSpace;
+
 public:
   Processor(std::string id_ = "") : id(id_) {
     if (id_.size() == 0) {
@@ -96,6 +118,19 @@ public:
   virtual ~Processor() {}
   virtual bool process(bool forceRecompute = false) = 0;
 
+  /**
+   * @brief Run process() on the shared ThreadPool
+   * @return future with the result, run time and error text
+   */
+  ProcessFuture processFuture(bool forceRecompute = false) {
+    return ProcessFuture::run(*this, forceRecompute);
+  }
+
+  /**
+   * @brief Description of the last failure of process(), if known
+   */
+  virtual std::string lastError() { return std::string(); }
+
   /**
    * @brief Convenience function to set input, output and running directory
    */
@@ -171,12 +206,53 @@ public:
   Processor &registerParameter(al::ParameterWrapper<ParameterType> &param) {
     mParameters.push_back(&param);
     param.registerChangeCallback([&](ParameterType value) {
-      configuration[param.getName()] = value;
-      process();
+      parameterChanged(param.getName(), value);
     });
     return *this;
   }
 
+  /**
+   * @brief Coalesce processing triggered by registered parameters
+   * @param debounceSeconds time without changes before processing starts
+   * @param cancelStale call requestCancel() on a running process() when a
+   * newer change arrives
+   *
+   * By default every change of a registered parameter calls process() on the
+   * thread that made the change. With coalescing, changes are collected and
+   * process() runs on the shared ThreadPool with the latest values, one run
+   * at a time. Changes arriving during a run cause a single run after it.
+   * Call waitForCoalesced() before destroying the processor.
+   */
+  void setCoalescing(bool coalesce, double debounceSeconds = 0.0,
+                     bool cancelStale = true);
+
+  /**
+   * @brief Wait until all coalesced changes have been processed
+   */
+  void waitForCoalesced();
+
+  /**
+   * @brief True if coalescing is on and cancels stale runs
+   */
+  bool cancelsStaleRuns();
+
+  CoalescingStats coalescingStats();
+
+  void resetCoalescingStats();
+
+  /**
+   * @brief Ask a running process() to finish early and fail
+   *
+   * process() implementations that support cancellation check
+   * cancelRequested(). The request is cleared when a coalesced run starts or
+   * with clearCancelRequest().
+   */
+  virtual void requestCancel() { mScheduling.cancelRequested = true; }
+
+  bool cancelRequested() { return mScheduling.cancelRequested; }
+
+  void clearCancelRequest() { mScheduling.cancelRequested = false; }
+
   template <class ParameterType>
   Processor &operator<<(al::ParameterWrapper<ParameterType> &newParam) {
     return registerParameter(newParam);
@@ -188,18 +264,49 @@ protected:
   std::string mInputDirectory;
   std::vector<std::string> mOutputFileNames;
   std::vector<std::string> mInputFileNames;
-  bool mVerbose;
+  bool mVerbose{false};
 
   std::vector<al::ParameterMeta *> mParameters;
 
+  /**
+   * @brief Path to fileName in directory, relative to the application's
+   * working directory
+   *
+   * fileName is returned unchanged if it is an absolute path. Files are
+   * accessed through these paths so the working directory is never changed
+   * and processors can do I/O from any thread.
+   */
+  static std::string pathInDirectory(const std::string &directory,
+                                     const std::string &fileName);
+
   void callDoneCallbacks(bool result) {
     for (auto cb : mDoneCallbacks) {
       cb(result);
     }
   }
 
+  /**
+   * @brief Set configuration value and process, or schedule processing if
+   * coalescing
+   */
+  void parameterChanged(const std::string &name, Flag value);
+
 private:
+  struct CoalesceState;
+
+  // Runs process() for the changes pending in state
+  void runCoalesced(std::shared_ptr<CoalesceState> state);
+
   std::vector<std::function<void(bool)>> mDoneCallbacks;
+
+  // Not shared with copies of the processor
+  struct SchedulingState {
+    std::atomic<bool> cancelRequested{false};
+    std::shared_ptr<CoalesceState> coalesce;
+    SchedulingState() {}
+    SchedulingState(const SchedulingState &) {}
+    SchedulingState &operator=(const SchedulingState &) { return *this; }
+  } mScheduling;
 };
 
 } // namespace tinc
@@ -3,13 +3,17 @@
 
 #include "tinc/Processor.hpp"
 
-#include <condition_variable>
-#include <memory>
-#include <mutex>
-#include <thread>
+#include <atomic>
+#include <utility>
 
 namespace tinc {
 
+/**
+ * @brief The ProcessorAsync class runs a processor on the shared ThreadPool
+ *
+ * process() returns as soon as the processor has been queued. Call
+ * waitUntilDone() to get the result.
+ */
 class ProcessorAsync : public Processor {
 public:
   ProcessorAsync(std::string id);
@@ -24,7 +28,7 @@ public:
     id = other.id;
   }
   ProcessorAsync(ProcessorAsync &&other) noexcept // move constructor
-      : mThread(std::exchange(other.mThread, nullptr)) {
+      : mProcessor(std::exchange(other.mProcessor, nullptr)) {
     id = other.id;
   }
   ProcessorAsync &operator=(const ProcessorAsync &other) // copy assignment
@@ -35,30 +39,33 @@ public:
   ProcessorAsync &operator=(ProcessorAsync &&other) noexcept // move assignment
   {
     id = other.id;
-    std::swap(mThread, other.mThread);
+    std::swap(mProcessor, other.mProcessor);
     return *this;
   }
 
+  /**
+   * @brief Queue processor to run
+   *
+   * Waits for a previous run to finish first.
+   */
   bool process(bool forceRecompute = false) override;
+
+  /**
+   * @brief Wait for the last run to finish
+   *
+   * If no pool thread has started the run yet, it runs on the calling thread.
+   * Other queued pool tasks are left to the pool.
+   * @return the result of the last run
+   */
   bool waitUntilDone();
 
   Processor *processor() const;
   void setProcessor(Processor *processor);
 
-protected:
-  void startThread();
-
 private:
   Processor *mProcessor{nullptr};
-  bool mRunning{true};
-  bool mRequestForce{false};
-  bool mRetValue;
-  std::unique_ptr<std::thread> mThread;
-  std::mutex mLock;
-  std::condition_variable mCondVariable;
-
-  std::mutex mStartLock;
-  std::condition_variable mStartCondVariable;
+  std::atomic<bool> mBusy{false};
+  std::atomic<bool> mRetValue{true};
 };
 
 } // namespace tinc
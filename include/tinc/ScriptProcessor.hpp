@@ -5,11 +5,19 @@
 #include "al/ui/al_Parameter.hpp"
 #include "al/ui/al_ParameterServer.hpp"
 
+#include "tinc/CacheIndex.hpp"
+#include "tinc/OutputCapture.hpp"
 #include "tinc/Processor.hpp"
+#include "tinc/ScriptWorkerPool.hpp"
 
 #include "nlohmann/json.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -59,6 +67,8 @@ public:
 
   /**
    * @brief Query current script file name
+   *
+   * The full path is relative to the application's working directory.
    */
   std::string scriptFile(bool fullPath = false);
 
@@ -89,6 +99,8 @@ public:
   static std::string sanitizeName(std::string output_name);
 
   // TODO remove these async calls
+  // Scripts are run on the shared ThreadPool, at most maxAsyncProcesses() at
+  // a time.
   bool processAsync(bool noWait = false,
                     std::function<void(bool)> doneCallback = nullptr);
 
@@ -102,7 +114,84 @@ public:
 
   void maxAsyncProcesses(int num) { mMaxAsyncProcesses = num; }
 
+  /**
+   * @brief Run the script in persistent interpreter processes
+   * @param numWorkers number of worker processes. 0 starts a new process for
+   * every call to process()
+   *
+   * Workers are started on the next call to process() with the script command
+   * running ScriptWorkerPool::pythonHarness(). The interpreter and the modules
+   * imported by the script are loaded only once per worker. The script
+   * receives the same json configuration file as when run from the command
+   * line.
+   */
+  void usePersistentWorkers(size_t numWorkers);
+
+  /**
+   * @brief Run jobs in a worker pool that can be shared with other processors
+   * @param pool started worker pool, or nullptr to stop using workers
+   */
+  void setWorkerPool(std::shared_ptr<ScriptWorkerPool> pool);
+
+  /**
+   * @brief Store cache metadata in index instead of a .meta file per output
+   * @param index open cache index, or nullptr to write .meta files
+   *
+   * Outputs without an entry in the index are checked against their .meta
+   * file, and moved to the index if it is still valid.
+   */
+  void setCacheIndex(std::shared_ptr<CacheIndex> index);
+
+  /**
+   * @brief Exit status, output and run time of the last script run
+   */
+  ScriptJobResult lastResult();
+
+  /**
+   * @brief Exit status and end of the error output of the last script run
+   */
+  std::string lastError() override;
+
+  /**
+   * @brief Terminate scripts this processor is running
+   *
+   * Only scripts started as separate processes can be cancelled, not jobs
+   * sent to a ScriptWorkerPool. When coalescing cancels stale runs, scripts
+   * run in their own process group and the processes they started are
+   * terminated too.
+   */
+  void requestCancel() override;
+
+  /**
+   * @brief Set function called for each line the script writes
+   *
+   * Called from the thread running the script as output arrives, e.g. to
+   * parse progress.
+   */
+  void setLineCallback(
+      std::function<void(const std::string &line, CaptureStream stream)>
+          callback) {
+    mLineCallback = callback;
+  }
+
+  /**
+   * @brief Write all output of the script to fileName in the running
+   * directory. Disabled if empty.
+   */
+  void setOutputLog(std::string fileName) { mOutputLog = fileName; }
+
+  /**
+   * @brief Bytes of standard output and of standard error kept in
+   * lastResult(). Only the end of longer output is kept.
+   */
+  void setOutputBufferSize(size_t size) { mOutputBufferSize = size; }
+
 protected:
+  /**
+   * @brief Configuration passed to the script, without writing it to disk
+   */
+  nlohmann::json configJson();
+
   std::string writeJsonConfig();
 
   void parametersToConfig(nlohmann::json &j);
@@ -114,28 +203,103 @@ private:
   std::mutex mProcessingLock;
   int mMaxAsyncProcesses{4};
   std::atomic<int> mNumAsyncProcesses{0};
-  std::vector<std::thread> mAsyncThreads;
   std::thread mAsyncDoneThread;
   std::condition_variable mAsyncDoneTrigger;
   std::mutex mAsyncDoneTriggerLock;
 
-  std::string makeCommandLine();
+  size_t mPersistentWorkers{0};
+  std::shared_ptr<ScriptWorkerPool> mWorkerPool;
+  ScriptJobResult mLastResult;
+  std::mutex mLastResultLock;
+  std::mutex mChildProcessesLock;
+  // Pids of running scripts, negated for scripts in their own process group
+  std::vector<int> mChildProcesses;
+
+  std::shared_ptr<CacheIndex> mCacheIndex;
+
+  std::function<void(const std::string &, CaptureStream)> mLineCallback;
+  std::string mOutputLog;
+  size_t mOutputBufferSize{1 << 20};
+
+  // Command line arguments to run script with json config file
+  std::vector<std::string> scriptArguments(const std::string &configFile);
+
+  // Command line arguments built from 'configuration' flags
+  std::vector<std::string> makeCommandArguments();
+
+  // Runs program in arguments[0] without a shell, in directory.
+  bool runCommand(const std::vector<std::string> &arguments,
+                  const std::string &directory);
+
+  // Run script for json config file in worker pool
+  bool runJob(const std::string &configFile);
+
+  void prepareCapture(OutputCapture &capture, const std::string &directory);
+
+  // Sets mLastResult from capture
+  void storeResult(OutputCapture &capture, int exitStatus, double seconds);
+
+  // Hash of configuration, command, script file and input files. File
+  // contents are hashed through FileHasher::shared()
+  std::string cacheKey();
 
-  bool runCommand(const std::string &command);
+  bool writeMeta(const std::string &key, double computeSeconds = 0.0);
 
-  bool writeMeta();
+  // Reads cache key from the .meta file. Valid version 0 files, which have no
+  // key, give key.
+  bool readMetaFile(const std::string &key, std::string &storedKey);
 
   al_sec modified(const char *path) const;
 
-  bool needsRecompute();
+  // True if the index or .meta file has a different cache key or an output
+  // file is missing
+  bool needsRecompute(const std::string &key);
 
   std::string metaFilename();
 };
 
+enum CacheEvictionPolicy {
+  CACHE_EVICT_LRU = 0,   // Least recently used first
+  CACHE_EVICT_COST_AWARE // Least compute time saved per byte and idle time
+};
+
+class ParameterSpace;
+
+/**
+ * @brief The CacheManager class manages the cache of a set of processors
+ *
+ * Cache entries are tracked in a CacheIndex opened with openCacheIndex().
+ * Evicted entries are removed from the index at once, so processors compute
+ * them again, and their files are deleted in a background thread so sweeps
+ * are not stalled.
+ */
 class CacheManager {
 public:
+  CacheManager() {}
+
+  ~CacheManager();
+
   void registerProcessor(Processor &processor) {
     mProcessors.push_back(&processor);
+    auto index = cacheIndex();
+    if (index) {
+      useCacheIndex(&processor, index);
+    }
+  }
+
+  /**
+   * @brief Keep cache metadata of registered processors in one index file in
+   * rootPath
+   *
+   * Replaces the .meta file that each ScriptProcessor writes next to its
+   * output. Existing .meta files are still read for outputs not yet in the
+   * index.
+   */
+  bool openCacheIndex(std::string rootPath);
+
+  std::shared_ptr<CacheIndex> cacheIndex() {
+    std::unique_lock<std::mutex> lk(mIndexLock);
+    return mCacheIndex;
   }
 
   void setRunningDirectory(std::string outputDirectory) {
@@ -150,13 +314,97 @@ public:
     }
   }
 
-  void clearCache() {
-    throw "Mot implemented yet.";
-    // TODO implement clear cache
-  }
+  /**
+   * @brief Limit the size and age of the cache
+   * @param maxBytes maximum total size of cached files. 0 for no limit
+   * @param maxAgeSeconds entries not used for longer are evicted. 0 for no
+   * limit
+   * @param checkInterval seconds between checks in the background thread
+   */
+  void setBudget(uint64_t maxBytes, double maxAgeSeconds = 0.0,
+                 double checkInterval = 10.0);
+
+  void setEvictionPolicy(CacheEvictionPolicy policy) { mPolicy = policy; }
+
+  /**
+   * @brief Evict entries until the cache is within budget
+   * @return number of entries evicted
+   */
+  size_t enforceBudget();
+
+  /**
+   * @brief Remove all entries
+   * @return number of entries removed
+   */
+  size_t clearCache();
+
+  /**
+   * @brief Remove entries written by the processor with id processorId
+   */
+  size_t clearCache(const std::string &processorId);
+
+  /**
+   * @brief Remove entries for outputs in the run paths of a region of space
+   * @param indexRanges [begin, end) index range for dimensions. Dimensions
+   * not listed are included whole.
+   */
+  size_t
+  clearCache(ParameterSpace &space,
+             std::map<std::string, std::pair<size_t, size_t>> indexRanges);
+
+  /**
+   * @brief Remove entries for which filter returns true
+   *
+   * filter receives the path as stored in the index and the entry.
+   */
+  size_t clearCacheIf(
+      std::function<bool(const std::string &, const CacheIndexEntry &)>
+          filter);
+
+  /**
+   * @brief Block until files of evicted entries have been deleted
+   */
+  void waitForDeletions();
+
+  size_t pendingDeletions();
 
 private:
+  struct Deletion {
+    std::string path;
+    std::vector<std::string> files;
+  };
+
+  void useCacheIndex(Processor *processor, std::shared_ptr<CacheIndex> index) {
+    auto *scriptProcessor = dynamic_cast<ScriptProcessor *>(processor);
+    if (scriptProcessor) {
+      scriptProcessor->setCacheIndex(index);
+    }
+  }
+
+  bool evict(CacheIndex &index, const std::string &storedPath,
+             const CacheIndexEntry &entry);
+
+  void startMaintenance();
+  void maintenanceLoop();
+
   std::vector<Processor *> mProcessors;
+  std::shared_ptr<CacheIndex> mCacheIndex;
+  std::mutex mIndexLock;
+
+  std::atomic<uint64_t> mMaxBytes{0};
+  std::atomic<double> mMaxAgeSeconds{0.0};
+  std::atomic<double> mCheckInterval{10.0};
+  std::atomic<CacheEvictionPolicy> mPolicy{CACHE_EVICT_LRU};
+  std::mutex mEvictionLock; // Serializes eviction passes
+
+  std::thread mMaintenanceThread;
+  std::mutex mMaintenanceLock;
+  std::condition_variable mMaintenanceTrigger;
+  std::condition_variable mDeletionsDone;
+  std::deque<Deletion> mDeletions;
+  size_t mPendingDeletions{0};
+  bool mStopMaintenance{false};
+  std::chrono::steady_clock::time_point mNextBudgetCheck;
 };
 
 class ParallelProcessor : public ScriptProcessor {
@@ -0,0 +1,122 @@
+#ifndef SCRIPTWORKERPOOL_HPP
+#define SCRIPTWORKERPOOL_HPP
+
+#include "nlohmann/json.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Result of a script run by a ScriptWorkerPool or ScriptProcessor
+ */
+struct ScriptJobResult {
+  int exitStatus{-1};
+  std::string output;      ///< Standard output, or its end if truncated
+  std::string errorOutput; ///< Standard error, or its end if truncated
+  uint64_t outputSize{0};  ///< Total bytes written to output and error
+  bool truncated{false};   ///< Output exceeded the capture buffer
+  double seconds{0.0};     ///< Wall clock run time
+};
+
+/**
+ * @brief The ScriptWorkerPool class keeps interpreter processes alive to run
+ * many jobs
+ *
+ * Workers are started once and receive jobs as single line JSON objects on
+ * their standard input. For each job, a worker must write a single line JSON
+ * object to its standard output with the fields "__tinc_job" (the id of the
+ * job), "__exit_status" and optionally "__output".
+ *
+ * The pool can be shared by several ScriptProcessor objects. runJob() blocks
+ * until a worker is free. Workers that die are restarted for the next job.
+ *
+ * Only supported on POSIX systems.
+ */
+class ScriptWorkerPool {
+public:
+  ScriptWorkerPool() {}
+
+  ~ScriptWorkerPool() { stop(); }
+
+  /**
+   * @brief Start worker processes
+   * @param arguments program and arguments of worker. The program is searched
+   * in PATH.
+   * @param numWorkers number of worker processes
+   * @return false if workers could not be started
+   */
+  bool start(std::vector<std::string> arguments, size_t numWorkers);
+
+  /**
+   * @brief Close worker input and wait for workers to exit
+   */
+  void stop();
+
+  bool running() { return mRunning; }
+
+  size_t size() { return mWorkers.size(); }
+
+  /**
+   * @brief Run job on the first free worker
+   * @param job JSON object sent to the worker. "__tinc_job" is set by the pool
+   * @param result exit status and output reported by the worker
+   * @return false if the job could not be delivered or the worker died
+   */
+  bool runJob(nlohmann::json job, ScriptJobResult &result);
+
+  /**
+   * @brief Arguments to run a Python script once per job
+   * @param pythonCommand python interpreter and its arguments, e.g.
+   * {"python3", "-B"}
+   *
+   * The harness expects jobs with fields "__script", "__config_file" and
+   * "__running_directory". It changes to the running directory and runs the
+   * script as __main__ with the config file as its only argument and the
+   * script's directory first in sys.path, as if called from the command
+   * line. sys.argv, sys.path and the working directory are restored after
+   * each job. Modules imported by the script stay loaded between jobs, so
+   * scripts should not rely on module level state being fresh.
+   */
+  static std::vector<std::string>
+  pythonHarness(std::vector<std::string> pythonCommand);
+
+private:
+  friend class ScriptProcessor;
+
+  /**
+   * @brief Create a pipe with close-on-exec set on both ends
+   *
+   * Processes started concurrently from other threads don't inherit the
+   * descriptors and keep the pipe open. Also used by ScriptProcessor to
+   * capture the output of the processes it starts.
+   */
+  static bool createPipe(int fds[2]);
+
+  struct Worker {
+    int pid{-1};
+    int input{-1};  // Job stream (worker's stdin)
+    int output{-1}; // Result stream (worker's stdout)
+    bool busy{false};
+    std::string buffer;
+  };
+
+  bool startWorker(Worker &worker);
+  void stopWorker(Worker &worker);
+  bool readLine(Worker &worker, std::string &line);
+
+  std::vector<std::string> mArguments;
+  std::vector<Worker> mWorkers;
+  std::mutex mWorkersLock;
+  std::condition_variable mWorkerFree;
+  std::atomic<bool> mRunning{false};
+  std::atomic<uint64_t> mNextJob{0};
+};
+
+} // namespace tinc
+
+#endif // SCRIPTWORKERPOOL_HPP
@@ -0,0 +1,125 @@
+#ifndef SWEEPCURSOR_HPP
+#define SWEEPCURSOR_HPP
+
+#include "tinc/ParameterSpaceDimension.hpp"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief The SweepCursor class holds a position within a parameter space
+ *
+ * It is a compact alternative to the std::map<std::string, size_t> index
+ * maps used by ParameterSpace::incrementIndeces(). Dimension pointers and
+ * strides are resolved once on construction, so moving through the space
+ * requires no name lookups.
+ *
+ * The first dimension varies fastest. ParameterSpace::createCursor() sorts
+ * dimensions by name so the traversal order matches incrementIndeces().
+ */
+class SweepCursor {
+public:
+  SweepCursor() {}
+
+  /**
+   * @param dimensions dimensions to traverse, first one varies fastest
+   * @param names names reported by toMap(). Dimension names if empty.
+   */
+  SweepCursor(std::vector<ParameterSpaceDimension *> dimensions,
+              std::vector<std::string> names = {});
+
+  /**
+   * @brief increment to next position
+   * @return true when no more positions to process (cursor wraps to start)
+   */
+  bool increment();
+
+  /**
+   * @brief go back to first position
+   */
+  void reset();
+
+  size_t dimensionCount() const { return mDimensions.size(); }
+
+  ParameterSpaceDimension *dimension(size_t i) const { return mDimensions[i]; }
+
+  /**
+   * @brief index for dimension number i within the cursor
+   */
+  size_t index(size_t i) const { return mIndeces[i]; }
+
+  /**
+   * @brief index for dimension, or 0 if dimension is not part of the cursor
+   */
+  size_t indexFor(const ParameterSpaceDimension *dimension) const;
+
+  const std::vector<size_t> &indeces() const { return mIndeces; }
+
+  /**
+   * @brief Total number of positions in the cursor
+   */
+  uint64_t size() const { return mTotalSize; }
+
+  /**
+   * @brief Position as an index into the flattened space
+   */
+  uint64_t linearIndex() const;
+
+  /**
+   * @brief Move to position in flattened space
+   * @return false if linearIndex is out of range. Cursor is not moved.
+   */
+  bool setLinearIndex(uint64_t linearIndex);
+
+  /**
+   * @brief Set index for dimension number i within the cursor
+   */
+  void setIndex(size_t i, size_t index) { mIndeces[i] = index; }
+
+  /**
+   * @brief Convert to the map representation used by ParameterSpace
+   */
+  std::map<std::string, size_t> toMap() const;
+
+private:
+  std::vector<ParameterSpaceDimension *> mDimensions;
+  std::vector<std::string> mNames;
+  std::vector<size_t> mIndeces;
+  std::vector<size_t> mSizes;
+  std::vector<uint64_t> mStrides;
+  uint64_t mTotalSize{0};
+};
+
+/**
+ * @brief The RunPathBuilder class builds paths with one directory per
+ * dimension of a SweepCursor, in cursor order.
+ *
+ * The previous path is kept, and only the directories from the first
+ * dimension whose index or data (see ParameterSpaceDimension::version())
+ * changed onwards are rewritten.
+ */
+class RunPathBuilder {
+public:
+  /**
+   * @brief Get relative path for cursor position
+   * @return reference to path, valid until next call to build() or reset()
+   */
+  const std::string &build(const SweepCursor &cursor);
+
+  void reset();
+
+private:
+  std::string mPath;
+  std::vector<ParameterSpaceDimension *> mDimensions;
+  std::vector<size_t> mIndeces;
+  std::vector<uint64_t> mVersions;
+  std::vector<size_t> mSegmentEnds; // End offset in mPath for each dimension
+};
+
+} // namespace tinc
+
+#endif // SWEEPCURSOR_HPP
@@ -0,0 +1,85 @@
+#ifndef SWEEPJOURNAL_HPP
+#define SWEEPJOURNAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief The SweepJournal class records completed samples of a sweep
+ *
+ * Completion and failure of each linear index of a sweep is appended to a
+ * journal file, so an interrupted sweep can be resumed without querying the
+ * processor's cache for every sample. When opened, the journal is replayed
+ * into a bitmap of completed samples and a set of failed samples. The file
+ * is compacted into a bitmap snapshot, on open and while recording, when the
+ * appended records grow larger than the bitmap.
+ */
+class SweepJournal {
+public:
+  SweepJournal(std::string filename) : mFilename(filename) {}
+
+  ~SweepJournal() { close(); }
+
+  /**
+   * @brief Open journal file and replay it.
+   * @param totalSamples total number of linear indeces in sweep
+   * @param sweepId identity of the processor and sweep space
+   * @return false if file can't be opened for writing
+   *
+   * If the journal was created for a different number of samples or a
+   * different sweepId, it is discarded.
+   */
+  bool open(uint64_t totalSamples, uint64_t sweepId = 0);
+
+  void close();
+
+  /**
+   * @brief Returns true if sample at linear index has completed successfully
+   */
+  bool isDone(uint64_t index);
+
+  /**
+   * @brief Number of samples completed in range [begin, end)
+   */
+  uint64_t doneCount(uint64_t begin, uint64_t end);
+
+  /**
+   * @brief Linear indeces that failed and have not completed since
+   */
+  std::vector<uint64_t> failedIndeces();
+
+  bool recordDone(uint64_t index);
+  bool recordFailed(uint64_t index);
+
+  /**
+   * @brief Rewrite journal as a bitmap snapshot plus failure records
+   */
+  bool compact();
+
+private:
+  typedef enum { SAMPLE_DONE = 1, SAMPLE_FAILED = 2 } SampleStatus;
+
+  bool appendRecord(uint64_t index, uint8_t status);
+  bool needsCompaction();
+  bool compactLocked();
+  bool writeSnapshot(std::FILE *file);
+
+  std::string mFilename;
+  std::FILE *mFile{nullptr};
+  uint64_t mTotalSamples{0};
+  uint64_t mSweepId{0};
+  uint64_t mRecordCount{0};
+  std::vector<uint8_t> mDoneBitmap;
+  std::set<uint64_t> mFailed;
+  std::mutex mLock;
+};
+
+} // namespace tinc
+
+#endif // SWEEPJOURNAL_HPP
@@ -0,0 +1,104 @@
+#ifndef SWEEPWORKQUEUE_HPP
+#define SWEEPWORKQUEUE_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace tinc {
+
+/**
+ * @brief The SweepWorkQueue class shares a parameter sweep between processes
+ *
+ * The linear index space of a sweep is split into chunks of fixed size. The
+ * state of each chunk is stored in a file that cooperating processes on the
+ * same host open and lock while claiming or completing chunks. Chunks claimed
+ * by processes that are no longer alive are handed out again. A claim
+ * records the pid and start time of the claiming process, so a pid reused
+ * by another process or a zombie doesn't hold on to the chunk.
+ *
+ * Only supported on POSIX systems.
+ */
+class SweepWorkQueue {
+public:
+  SweepWorkQueue(std::string filename) : mFilename(filename) {}
+
+  ~SweepWorkQueue() { close(); }
+
+  /**
+   * @brief Open queue file, creating and initializing it if needed
+   * @param totalSamples total number of linear indeces in sweep
+   * @param chunkSize number of linear indeces per chunk
+   * @param sweepId identifies the sweep, e.g. a hash of its dimensions and
+   * processor
+   * @return false if the file can't be opened or was created for a
+   * different sweep
+   */
+  bool open(uint64_t totalSamples, uint64_t chunkSize, uint64_t sweepId = 0);
+
+  void close();
+
+  /**
+   * @brief Close and delete the queue file
+   *
+   * Must only be called when no process is using the queue.
+   */
+  bool remove();
+
+  /**
+   * @brief Claim a chunk of work for this process
+   * @param begin first linear index of chunk
+   * @param end linear index after last index of chunk
+   * @return false if no chunks are available
+   */
+  bool claimChunk(uint64_t &begin, uint64_t &end);
+
+  /**
+   * @brief Mark chunk starting at begin as done
+   */
+  bool completeChunk(uint64_t begin);
+
+  /**
+   * @brief Return chunk starting at begin to the queue
+   */
+  bool releaseChunk(uint64_t begin);
+
+  /**
+   * @brief Returns true if all chunks have been completed
+   */
+  bool finished();
+
+  uint64_t chunkCount() { return mChunkCount; }
+
+private:
+  typedef enum { CHUNK_FREE = 0, CHUNK_CLAIMED, CHUNK_DONE } ChunkState;
+
+  struct Header {
+    char magic[8];
+    uint64_t totalSamples;
+    uint64_t chunkSize;
+    uint64_t sweepId;
+    uint64_t nextFree; // All chunks below this have been claimed at least once
+  };
+
+  struct ChunkRecord {
+    uint32_t state;
+    int32_t pid;
+    uint64_t startTime; // Of process pid, to detect reused pids
+  };
+
+  bool readHeader(Header &header);
+  bool writeHeader(Header &header);
+  bool readRecord(uint64_t chunk, ChunkRecord &record);
+  bool writeRecord(uint64_t chunk, ChunkRecord &record);
+  bool setChunkState(uint64_t begin, ChunkState state);
+
+  std::string mFilename;
+  int mFd{-1};
+  uint64_t mTotalSamples{0};
+  uint64_t mChunkSize{1};
+  uint64_t mChunkCount{0};
+};
+
+} // namespace tinc
+
+#endif // SWEEPWORKQUEUE_HPP
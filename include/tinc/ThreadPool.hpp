@@ -0,0 +1,179 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tinc {
+
+/**
+ * @brief Queue and task counters of a ThreadPool
+ */
+struct ThreadPoolStats {
+  size_t threads{0};
+  size_t activeTasks{0};   ///< Tasks running now
+  size_t queuedTasks{0};   ///< Tasks waiting in all queues
+  size_t peakQueuedTasks{0}; ///< Largest queuedTasks since last resetStats()
+  std::vector<size_t> workerQueueDepths; ///< Tasks waiting per worker
+  uint64_t submitted{0};
+  uint64_t completed{0};
+  uint64_t stolen{0}; ///< Tasks taken from another worker's queue
+};
+
+/**
+ * @brief The ThreadPool class runs tasks on a set of worker threads with
+ * work stealing
+ *
+ * Each worker has its own queue. Tasks submitted from a worker go to the back
+ * of its queue and are taken from the back, so related work stays on the
+ * same thread. Tasks submitted from other threads go to a shared queue. Idle
+ * workers take from the shared queue, then steal from the front of other
+ * workers' queues.
+ *
+ * Tasks must not block waiting for other tasks of the same pool, as all
+ * workers could end up waiting. Submit the awaited tasks with a group and
+ * wait with waitUntil() for that group, which runs them on the waiting
+ * thread if no worker has taken them yet.
+ */
+class ThreadPool {
+public:
+  /**
+   * @param numThreads number of threads. Number of hardware threads if 0
+   */
+  ThreadPool(size_t numThreads = 0);
+
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief Queue task to run on a pool thread
+   * @param group lets waitUntil() calls for the group run the task. Usually
+   * the object whose state the task updates.
+   */
+  void submit(std::function<void()> task, const void *group = nullptr);
+
+  /**
+   * @brief Queue task to run once seconds have passed
+   *
+   * Delayed tasks are released by idle workers, or by busy workers between
+   * tasks, so they may start late when all workers run long tasks.
+   */
+  void submitAfter(double seconds, std::function<void()> task,
+                   const void *group = nullptr);
+
+  /**
+   * @brief Run one queued task on the calling thread
+   * @return false if no task was queued
+   */
+  bool runPendingTask();
+
+  /**
+   * @brief Wait until done returns true
+   * @param groups queued tasks of these groups are run on the calling thread
+   * while it waits
+   *
+   * Only tasks of groups are run, never unrelated ones, as the caller may
+   * hold locks that other tasks need, or be a thread that must stay
+   * responsive. done is checked after each task completes and periodically,
+   * so it can also depend on work outside the pool.
+   */
+  void waitUntil(const std::function<bool()> &done,
+                 std::vector<const void *> groups = {});
+
+  size_t size();
+
+  /**
+   * @brief Change the number of threads. Number of hardware threads if 0
+   *
+   * Waits for running and queued tasks to finish. Must not be called from a
+   * task.
+   */
+  void setSize(size_t numThreads);
+
+  /**
+   * @brief Pin worker threads to CPUs
+   * @param cpus worker n runs on cpus[n % cpus.size()]. Empty to unpin
+   * @return false if not supported or the CPUs can't be used
+   *
+   * Only supported on Linux. Also applies to threads added by setSize().
+   */
+  bool setCpuAffinity(std::vector<int> cpus);
+
+  ThreadPoolStats stats();
+
+  void resetStats();
+
+  /**
+   * @brief Pool shared by the library
+   *
+   * Used by ProcessorAsync, ComputationChain, DeferredComputation and
+   * ScriptProcessor::processAsync(). Configure with setSize() and
+   * setCpuAffinity() before starting work.
+   */
+  static ThreadPool &shared();
+
+private:
+  struct Task {
+    std::function<void()> run;
+    const void *group;
+  };
+
+  struct TaskQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  struct DelayedTask {
+    std::chrono::steady_clock::time_point due;
+    std::function<void()> task;
+    const void *group;
+    bool operator<(const DelayedTask &other) const { return due > other.due; }
+  };
+
+  void startWorkers(size_t numThreads);
+  void stopWorkers();
+  void workerLoop(size_t index);
+  bool popTask(std::function<void()> &task);
+  bool popGroupTask(std::function<void()> &task,
+                    const std::vector<const void *> &groups);
+  void runTask(std::function<void()> &task);
+  bool applyAffinity(size_t index);
+  void releaseDueTasks();
+
+  std::mutex mConfigLock; // Held while changing workers
+  std::vector<std::thread> mThreads;
+  std::vector<std::unique_ptr<TaskQueue>> mWorkerQueues;
+  TaskQueue mSharedQueue;
+  std::vector<int> mCpus;
+
+  std::mutex mSleepLock;
+  std::condition_variable mTaskAvailable;
+  std::condition_variable mStateChanged;
+  bool mStopping{false};
+  std::atomic<int> mWaiters{0};
+  std::atomic<uint64_t> mEvents{0}; // Counts submits and completions
+  std::vector<DelayedTask> mDelayed; // Heap, protected by mSleepLock
+  std::atomic<int64_t> mNextDueNs{std::numeric_limits<int64_t>::max()};
+
+  std::atomic<int64_t> mQueued{0};
+  std::atomic<size_t> mPeakQueued{0};
+  std::atomic<size_t> mActive{0};
+  std::atomic<uint64_t> mSubmitted{0};
+  std::atomic<uint64_t> mCompleted{0};
+  std::atomic<uint64_t> mStolen{0};
+};
+
+} // namespace tinc
+
+#endif // THREADPOOL_HPP
@@ -0,0 +1,627 @@
+#include "tinc/CacheIndex.hpp"
+#include "tinc/FileHasher.hpp"
+
+#include "al/io/al_File.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINC_CACHE_INDEX_MMAP
+#elif defined(AL_WINDOWS)
+#include <direct.h> // for _getcwd()
+#define getcwd _getcwd
+#endif
+
+using namespace tinc;
+
+static const char indexMagic[8] = {'T', 'I', 'N', 'C', 'I', 'D', 'X', '1'};
+
+enum CacheIndexOp : uint8_t {
+  CACHE_INDEX_PUT = 1,
+  CACHE_INDEX_REMOVE = 2,
+  CACHE_INDEX_TOUCH = 3
+};
+
+// Records are [payload size (u32)][checksum (u32)][payload], little endian
+static void putU32(std::string &data, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    data.push_back(char(value >> (i * 8)));
+  }
+}
+
+static void putU64(std::string &data, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    data.push_back(char(value >> (i * 8)));
+  }
+}
+
+static uint32_t getU32(const unsigned char *p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+static uint64_t getU64(const unsigned char *p) {
+  return uint64_t(getU32(p)) | (uint64_t(getU32(p + 4)) << 32);
+}
+
+static std::string makeRecord(const std::string &payload) {
+  std::string record;
+  putU32(record, uint32_t(payload.size()));
+  putU32(record, uint32_t(HashState::hash(payload.data(), payload.size())));
+  return record + payload;
+}
+
+static std::string putRecord(const std::string &path,
+                             const CacheIndexEntry &entry) {
+  std::string payload;
+  payload.push_back(char(CACHE_INDEX_PUT));
+  putU32(payload, uint32_t(path.size()));
+  payload += path;
+  putU32(payload, uint32_t(entry.cacheKey.size()));
+  payload += entry.cacheKey;
+  putU64(payload, uint64_t(entry.writtenNs));
+  uint64_t seconds;
+  memcpy(&seconds, &entry.computeSeconds, sizeof(seconds));
+  putU64(payload, seconds);
+  // Fields below were added later and are optional when reading
+  putU64(payload, entry.sizeBytes);
+  putU64(payload, uint64_t(entry.accessedNs));
+  putU32(payload, uint32_t(entry.processorId.size()));
+  payload += entry.processorId;
+  putU32(payload, uint32_t(entry.files.size()));
+  for (auto &file : entry.files) {
+    putU32(payload, uint32_t(file.size()));
+    payload += file;
+  }
+  return makeRecord(payload);
+}
+
+static std::string touchRecord(const std::string &path, int64_t accessedNs) {
+  std::string payload;
+  payload.push_back(char(CACHE_INDEX_TOUCH));
+  putU32(payload, uint32_t(path.size()));
+  payload += path;
+  putU64(payload, uint64_t(accessedNs));
+  return makeRecord(payload);
+}
+
+static std::string removeRecord(const std::string &path) {
+  std::string payload;
+  payload.push_back(char(CACHE_INDEX_REMOVE));
+  putU32(payload, uint32_t(path.size()));
+  payload += path;
+  return makeRecord(payload);
+}
+
+// Holds an exclusive lock on the index's lock file while in scope. The lock
+// can't be taken on the index itself, as compaction replaces that file.
+class IndexFileLock {
+public:
+  explicit IndexFileLock(int fd) : mFd(fd) {
+#ifdef TINC_CACHE_INDEX_MMAP
+    while (mFd >= 0 && flock(mFd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+#endif
+  }
+
+  ~IndexFileLock() {
+#ifdef TINC_CACHE_INDEX_MMAP
+    if (mFd >= 0) {
+      flock(mFd, LOCK_UN);
+    }
+#endif
+  }
+
+private:
+  int mFd;
+};
+
+// Reads string of u32 length at offset. Returns false if it overruns size
+static bool getString(const unsigned char *p, size_t size, size_t &offset,
+                      std::string &value) {
+  if (offset + 4 > size) {
+    return false;
+  }
+  uint32_t length = getU32(p + offset);
+  offset += 4;
+  if (offset + length > size) {
+    return false;
+  }
+  value.assign(reinterpret_cast<const char *>(p + offset), length);
+  offset += length;
+  return true;
+}
+
+// Applies records in data from offset to entries. Returns the size of the
+// valid prefix
+static size_t
+replayLog(const unsigned char *data, size_t size, size_t offset,
+          std::unordered_map<std::string, CacheIndexEntry> &entries,
+          uint64_t &recordCount) {
+  while (offset + 8 <= size) {
+    uint32_t payloadSize = getU32(data + offset);
+    uint32_t checksum = getU32(data + offset + 4);
+    const unsigned char *payload = data + offset + 8;
+    if (payloadSize == 0 || offset + 8 + payloadSize > size ||
+        uint32_t(HashState::hash(payload, payloadSize)) != checksum) {
+      break;
+    }
+    size_t pos = 1;
+    std::string path;
+    if (!getString(payload, payloadSize, pos, path)) {
+      break;
+    }
+    if (payload[0] == CACHE_INDEX_PUT) {
+      CacheIndexEntry entry;
+      if (!getString(payload, payloadSize, pos, entry.cacheKey) ||
+          pos + 16 > payloadSize) {
+        break;
+      }
+      entry.writtenNs = int64_t(getU64(payload + pos));
+      uint64_t seconds = getU64(payload + pos + 8);
+      memcpy(&entry.computeSeconds, &seconds, sizeof(seconds));
+      entry.accessedNs = entry.writtenNs;
+      pos += 16;
+      if (pos < payloadSize) {
+        if (pos + 16 > payloadSize) {
+          break;
+        }
+        entry.sizeBytes = getU64(payload + pos);
+        entry.accessedNs = int64_t(getU64(payload + pos + 8));
+        pos += 16;
+        if (!getString(payload, payloadSize, pos, entry.processorId) ||
+            pos + 4 > payloadSize) {
+          break;
+        }
+        uint32_t fileCount = getU32(payload + pos);
+        pos += 4;
+        bool ok = true;
+        for (uint32_t i = 0; i < fileCount && ok; i++) {
+          std::string file;
+          ok = getString(payload, payloadSize, pos, file);
+          entry.files.push_back(file);
+        }
+        if (!ok) {
+          break;
+        }
+      }
+      entries[path] = entry;
+    } else if (payload[0] == CACHE_INDEX_TOUCH) {
+      if (pos + 8 > payloadSize) {
+        break;
+      }
+      auto it = entries.find(path);
+      if (it != entries.end()) {
+        it->second.accessedNs = int64_t(getU64(payload + pos));
+      }
+    } else if (payload[0] == CACHE_INDEX_REMOVE) {
+      entries.erase(path);
+    } else {
+      break;
+    }
+    recordCount++;
+    offset += 8 + payloadSize;
+  }
+  return offset;
+}
+
+bool CacheIndex::open(std::string rootPath) {
+  close();
+  std::unique_lock<std::mutex> lk(mLock);
+  mRootPath = rootPath.size() > 0 ? al::File::conformPathToOS(rootPath) : "";
+  if (mRootPath.size() > 0 && !al::File::isDirectory(mRootPath)) {
+    if (!al::Dir::make(mRootPath)) {
+      std::cerr << "ERROR creating cache directory: " << mRootPath
+                << std::endl;
+      return false;
+    }
+  }
+  mIndexPath = mRootPath + indexFileName();
+  char currentDirectory[4096];
+  if (getcwd(currentDirectory, sizeof(currentDirectory))) {
+    mCurrentDirectory = al::File::conformPathToOS(currentDirectory);
+  }
+#ifdef TINC_CACHE_INDEX_MMAP
+  mLockFile = ::open((mIndexPath + ".lock").c_str(),
+                     O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (mLockFile < 0) {
+    std::cerr << "ERROR opening cache index lock: " << mIndexPath << ".lock"
+              << std::endl;
+    return false;
+  }
+#endif
+  IndexFileLock fileLock(mLockFile);
+  bool clean = load();
+  if (!openLog()) {
+    return false;
+  }
+  if (!clean || mRecordCount > 2 * mEntries.size() + 1024) {
+    return compactLocked();
+  }
+  return true;
+}
+
+void CacheIndex::close() {
+  std::unique_lock<std::mutex> lk(mLock);
+  if (mFile) {
+    fclose(mFile);
+    mFile = nullptr;
+  }
+#ifdef TINC_CACHE_INDEX_MMAP
+  if (mLockFile >= 0) {
+    ::close(mLockFile);
+    mLockFile = -1;
+  }
+#endif
+  mEntries.clear();
+  mRecordCount = 0;
+  mTotalBytes = 0;
+  mLogSize = 0;
+}
+
+bool CacheIndex::isOpen() {
+  std::unique_lock<std::mutex> lk(mLock);
+  return mFile != nullptr;
+}
+
+bool CacheIndex::find(const std::string &path, CacheIndexEntry &entry) {
+  std::unique_lock<std::mutex> lk(mLock);
+  auto it = mEntries.find(relativePath(path));
+  if (it == mEntries.end()) {
+    return false;
+  }
+  entry = it->second;
+  return true;
+}
+
+bool CacheIndex::put(const std::string &path, const CacheIndexEntry &entry) {
+  std::unique_lock<std::mutex> lk(mLock);
+  IndexFileLock fileLock(mLockFile);
+  if (!refreshLocked()) {
+    return false;
+  }
+  auto relative = relativePath(path);
+  CacheIndexEntry stored = entry;
+  for (auto &file : stored.files) {
+    file = relativePath(file);
+  }
+  if (!append(putRecord(relative, stored))) {
+    return false;
+  }
+  auto existing = mEntries.find(relative);
+  if (existing != mEntries.end()) {
+    mTotalBytes -= existing->second.sizeBytes;
+  }
+  mTotalBytes += stored.sizeBytes;
+  mEntries[relative] = stored;
+  if (mRecordCount > 2 * mEntries.size() + 1024) {
+    return compactLocked();
+  }
+  return true;
+}
+
+bool CacheIndex::remove(const std::string &path) {
+  std::unique_lock<std::mutex> lk(mLock);
+  IndexFileLock fileLock(mLockFile);
+  if (!refreshLocked()) {
+    return false;
+  }
+  auto relative = relativePath(path);
+  auto existing = mEntries.find(relative);
+  if (existing == mEntries.end()) {
+    return true;
+  }
+  if (!append(removeRecord(relative))) {
+    return false;
+  }
+  mTotalBytes -= existing->second.sizeBytes;
+  mEntries.erase(existing);
+  if (mRecordCount > 2 * mEntries.size() + 1024) {
+    return compactLocked();
+  }
+  return true;
+}
+
+bool CacheIndex::touch(const std::string &path) {
+  std::unique_lock<std::mutex> lk(mLock);
+  auto relative = relativePath(path);
+  auto existing = mEntries.find(relative);
+  if (existing == mEntries.end()) {
+    return false;
+  }
+  int64_t now = nowNs();
+  if (now - existing->second.accessedNs < mTouchIntervalNs) {
+    return true;
+  }
+  IndexFileLock fileLock(mLockFile);
+  if (!refreshLocked()) {
+    return false;
+  }
+  existing = mEntries.find(relative);
+  if (existing == mEntries.end()) {
+    return false; // Removed by another process
+  }
+  if (!append(touchRecord(relative, now))) {
+    return false;
+  }
+  existing->second.accessedNs = now;
+  if (mRecordCount > 2 * mEntries.size() + 1024) {
+    return compactLocked();
+  }
+  return true;
+}
+
+std::vector<std::pair<std::string, CacheIndexEntry>> CacheIndex::entries() {
+  std::unique_lock<std::mutex> lk(mLock);
+  return std::vector<std::pair<std::string, CacheIndexEntry>>(
+      mEntries.begin(), mEntries.end());
+}
+
+size_t CacheIndex::size() {
+  std::unique_lock<std::mutex> lk(mLock);
+  return mEntries.size();
+}
+
+uint64_t CacheIndex::totalBytes() {
+  std::unique_lock<std::mutex> lk(mLock);
+  return mTotalBytes;
+}
+
+bool CacheIndex::compact() {
+  std::unique_lock<std::mutex> lk(mLock);
+  IndexFileLock fileLock(mLockFile);
+  if (!refreshLocked()) {
+    return false;
+  }
+  return compactLocked();
+}
+
+bool CacheIndex::sync() {
+  std::unique_lock<std::mutex> lk(mLock);
+  if (!mFile || fflush(mFile) != 0) {
+    return false;
+  }
+#ifdef TINC_CACHE_INDEX_MMAP
+  return fsync(fileno(mFile)) == 0;
+#else
+  return true;
+#endif
+}
+
+static bool isAbsolute(const std::string &path) {
+  bool absolute = path.size() > 0 && (path[0] == '/' || path[0] == '\\');
+#ifdef AL_WINDOWS
+  absolute = absolute || (path.size() > 1 && path[1] == ':');
+#endif
+  return absolute;
+}
+
+// Paths outside the root are stored as absolute paths, so they can be told
+// apart from paths relative to the root.
+std::string CacheIndex::relativePath(const std::string &path) {
+  if (mRootPath.size() == 0) {
+    return path;
+  }
+  if (path.compare(0, mRootPath.size(), mRootPath) == 0) {
+    return path.substr(mRootPath.size());
+  }
+  if (!isAbsolute(path)) {
+    return mCurrentDirectory + path;
+  }
+  return path;
+}
+
+std::string CacheIndex::fullPath(const std::string &storedPath) {
+  if (isAbsolute(storedPath)) {
+    return storedPath;
+  }
+  return mRootPath + storedPath;
+}
+
+int64_t CacheIndex::nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+bool CacheIndex::load() {
+  mEntries.clear();
+  mRecordCount = 0;
+  mTotalBytes = 0;
+  mLogSize = 0;
+  return readLog();
+}
+
+bool CacheIndex::readLog() {
+  size_t size = 0;
+  size_t validSize = 0;
+  size_t offset = size_t(mLogSize);
+#ifdef TINC_CACHE_INDEX_MMAP
+  int fd = ::open(mIndexPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return true; // New index
+  }
+  struct stat s;
+  if (fstat(fd, &s) != 0) {
+    ::close(fd);
+    return false;
+  }
+  if (size_t(s.st_size) <= offset) {
+    ::close(fd);
+    return true;
+  }
+  size = size_t(s.st_size);
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    // Start empty, but don't let compaction discard the existing records
+    std::cerr << "ERROR mapping cache index: " << mIndexPath << std::endl;
+    return true;
+  }
+  auto data = static_cast<const unsigned char *>(map);
+  if (offset > 0) {
+    validSize = replayLog(data, size, offset, mEntries, mRecordCount);
+  } else if (size >= sizeof(indexMagic) &&
+             memcmp(data, indexMagic, sizeof(indexMagic)) == 0) {
+    validSize =
+        replayLog(data, size, sizeof(indexMagic), mEntries, mRecordCount);
+  }
+  munmap(map, size);
+#else
+  std::ifstream f(mIndexPath, std::ifstream::in | std::ifstream::binary);
+  if (!f.good()) {
+    return true; // New index
+  }
+  std::stringstream ss;
+  ss << f.rdbuf();
+  std::string contents = ss.str();
+  size = contents.size();
+  if (size <= offset) {
+    return true;
+  }
+  auto data = reinterpret_cast<const unsigned char *>(contents.data());
+  if (offset > 0) {
+    validSize = replayLog(data, size, offset, mEntries, mRecordCount);
+  } else if (size >= sizeof(indexMagic) &&
+             memcmp(data, indexMagic, sizeof(indexMagic)) == 0) {
+    validSize =
+        replayLog(data, size, sizeof(indexMagic), mEntries, mRecordCount);
+  }
+#endif
+  mLogSize = validSize;
+  mTotalBytes = 0;
+  for (auto &entry : mEntries) {
+    mTotalBytes += entry.second.sizeBytes;
+  }
+  if (validSize < size) {
+    std::cerr << "WARNING: discarding " << size - validSize
+              << " bytes of invalid records from cache index " << mIndexPath
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool CacheIndex::refreshLocked() {
+#ifdef TINC_CACHE_INDEX_MMAP
+  if (!mFile) {
+    std::cerr << "ERROR: cache index not open" << std::endl;
+    return false;
+  }
+  struct stat onDisk;
+  struct stat current;
+  bool replaced = stat(mIndexPath.c_str(), &onDisk) != 0 ||
+                  fstat(fileno(mFile), &current) != 0 ||
+                  onDisk.st_ino != current.st_ino ||
+                  onDisk.st_dev != current.st_dev;
+  bool clean;
+  if (replaced) {
+    // Another process compacted the log. Its log has our records too.
+    fclose(mFile);
+    mFile = nullptr;
+    clean = load();
+    if (!openLog()) {
+      return false;
+    }
+  } else if (uint64_t(onDisk.st_size) != mLogSize) {
+    clean = readLog();
+  } else {
+    return true;
+  }
+  if (!clean) {
+    // Records appended after invalid ones would be lost on load
+    return compactLocked();
+  }
+#endif
+  return true;
+}
+
+bool CacheIndex::openLog() {
+  mFile = fopen(mIndexPath.c_str(), "ab");
+  if (!mFile) {
+    std::cerr << "ERROR opening cache index: " << mIndexPath << std::endl;
+    return false;
+  }
+  fseek(mFile, 0, SEEK_END);
+  if (ftell(mFile) == 0) {
+    if (fwrite(indexMagic, sizeof(indexMagic), 1, mFile) != 1 ||
+        fflush(mFile) != 0) {
+      std::cerr << "ERROR writing cache index: " << mIndexPath << std::endl;
+      fclose(mFile);
+      mFile = nullptr;
+      return false;
+    }
+    mLogSize = sizeof(indexMagic);
+  }
+  return true;
+}
+
+bool CacheIndex::append(const std::string &record) {
+  if (!mFile) {
+    std::cerr << "ERROR: cache index not open" << std::endl;
+    return false;
+  }
+  // Flushed after each record, so a crash loses at most the record being
+  // written. Partial records fail their checksum on load.
+  if (fwrite(record.data(), record.size(), 1, mFile) != 1 ||
+      fflush(mFile) != 0) {
+    std::cerr << "ERROR writing cache index: " << mIndexPath << std::endl;
+    return false;
+  }
+  mRecordCount++;
+  mLogSize += record.size();
+  return true;
+}
+
+bool CacheIndex::compactLocked() {
+  std::string tempPath = mIndexPath + ".tmp";
+  FILE *temp = fopen(tempPath.c_str(), "wb");
+  if (!temp) {
+    std::cerr << "ERROR writing cache index: " << tempPath << std::endl;
+    return false;
+  }
+  bool ok = fwrite(indexMagic, sizeof(indexMagic), 1, temp) == 1;
+  uint64_t logSize = sizeof(indexMagic);
+  for (auto &entry : mEntries) {
+    if (!ok) {
+      break;
+    }
+    auto record = putRecord(entry.first, entry.second);
+    ok = fwrite(record.data(), record.size(), 1, temp) == 1;
+    logSize += record.size();
+  }
+  ok = fflush(temp) == 0 && ok;
+#ifdef TINC_CACHE_INDEX_MMAP
+  ok = fsync(fileno(temp)) == 0 && ok;
+#endif
+  fclose(temp);
+  if (!ok) {
+    std::cerr << "ERROR writing cache index: " << tempPath << std::endl;
+    std::remove(tempPath.c_str());
+    return false;
+  }
+  // The complete new log replaces the old one in a single step
+  if (mFile) {
+    fclose(mFile);
+    mFile = nullptr;
+  }
+#ifndef TINC_CACHE_INDEX_MMAP
+  std::remove(mIndexPath.c_str());
+#endif
+  if (std::rename(tempPath.c_str(), mIndexPath.c_str()) != 0) {
+    std::cerr << "ERROR replacing cache index: " << mIndexPath << std::endl;
+  }
+  mRecordCount = mEntries.size();
+  mLogSize = logSize;
+  return openLog();
+}
@@ -1,22 +1,93 @@
 #include "tinc/ComputationChain.hpp"
+#include "tinc/ThreadPool.hpp"
 
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 
 using namespace tinc;
 
+namespace {
+
+// State of one PROCESS_DAG run. Shared with the pool tasks, which may run
+// after process() has returned and find nothing left to do.
+struct GraphRun {
+  std::vector<Processor *> nodes;
+  std::vector<std::vector<size_t>> successors;
+  std::vector<size_t> pending; // Unfinished dependencies per node
+  std::vector<bool> skipped;
+  std::deque<size_t> ready;
+  size_t remaining{0}; // Nodes not yet finished or skipped
+  bool ok{true};
+  bool forceRecompute{false};
+  std::mutex lock;
+  std::condition_variable changed;
+};
+
+bool runReadyNode(const std::shared_ptr<GraphRun> &run) {
+  size_t index;
+  {
+    std::unique_lock<std::mutex> lk(run->lock);
+    if (run->ready.empty()) {
+      return false;
+    }
+    index = run->ready.front();
+    run->ready.pop_front();
+  }
+  Processor *node = run->nodes[index];
+  bool ok = node->process(run->forceRecompute);
+  size_t newlyReady = 0;
+  {
+    std::unique_lock<std::mutex> lk(run->lock);
+    run->ok &= ok;
+    if (!ok && !node->ignoreFail) {
+      // Nothing that depends on this node can run
+      std::vector<size_t> stack = run->successors[index];
+      while (!stack.empty()) {
+        size_t skip = stack.back();
+        stack.pop_back();
+        if (!run->skipped[skip]) {
+          run->skipped[skip] = true;
+          run->remaining--;
+          stack.insert(stack.end(), run->successors[skip].begin(),
+                       run->successors[skip].end());
+        }
+      }
+    } else {
+      for (auto successor : run->successors[index]) {
+        if (!run->skipped[successor] && --run->pending[successor] == 0) {
+          run->ready.push_back(successor);
+          newlyReady++;
+        }
+      }
+    }
+    run->remaining--;
+  }
+  for (size_t i = 0; i < newlyReady; i++) {
+    ThreadPool::shared().submit([run]() { runReadyNode(run); });
+  }
+  run->changed.notify_all();
+  return true;
+}
+
+} // namespace
+
 void ComputationChain::addProcessor(Processor &chain) {
   std::unique_lock<std::mutex> lk(mChainLock);
-  switch (mType) {
-  case PROCESS_ASYNC:
-    // FIXME check if process is already async, so there's no need to do this.
-    // FIXME free this on destructor
-    mAsyncProcessesInternal.emplace_back(new ProcessorAsync(&chain));
-    mProcessors.push_back(mAsyncProcessesInternal.back());
-    break;
-  case PROCESS_SERIAL:
-    mProcessors.push_back(&chain);
-    break;
+  mProcessors.push_back(&chain);
+}
+
+void ComputationChain::addDependency(Processor &processor,
+                                     Processor &dependency) {
+  std::unique_lock<std::mutex> lk(mChainLock);
+  if (mType != PROCESS_DAG) {
+    std::cerr << "WARNING: dependencies are only used in PROCESS_DAG chains"
+              << std::endl;
   }
+  mDependencies.push_back({&dependency, &processor});
 }
 
 bool ComputationChain::process(bool forceRecompute) {
@@ -35,13 +106,7 @@ bool ComputationChain::process(bool forceRecompute) {
   bool thisRet = true;
   switch (mType) {
   case PROCESS_ASYNC:
-    for (auto chain : mProcessors) {
-      chain->process(forceRecompute);
-    }
-    for (auto chain : mProcessors) {
-      // When running async ignoreFail has no effect
-      ret &= ((ProcessorAsync *)chain)->waitUntilDone();
-    }
+    ret = processAll(forceRecompute);
     break;
   case PROCESS_SERIAL:
     for (auto chain : mProcessors) {
@@ -52,7 +117,131 @@ bool ComputationChain::process(bool forceRecompute) {
       }
     }
     break;
+  case PROCESS_DAG:
+    ret = processGraph(forceRecompute);
+    break;
   }
   callDoneCallbacks(ret);
   return ret;
 }
+
+bool ComputationChain::processAll(bool forceRecompute) {
+  // When running async ignoreFail has no effect
+  std::vector<ProcessFuture> futures;
+  for (auto chain : mProcessors) {
+    futures.push_back(chain->processFuture(forceRecompute));
+  }
+  return ProcessFuture::whenAll(futures).get().ok;
+}
+
+bool ComputationChain::buildGraph(std::vector<std::vector<size_t>> &successors,
+                                  std::vector<size_t> &pending) {
+  std::map<Processor *, size_t> indices;
+  for (size_t i = 0; i < mProcessors.size(); i++) {
+    indices[mProcessors[i]] = i;
+  }
+  std::set<std::pair<size_t, size_t>> edges;
+  for (auto &dependency : mDependencies) {
+    auto before = indices.find(dependency.first);
+    auto after = indices.find(dependency.second);
+    if (before == indices.end() || after == indices.end()) {
+      std::cerr << "ERROR: dependency between '" << dependency.first->id
+                << "' and '" << dependency.second->id
+                << "' uses processor not in chain " << id << std::endl;
+      return false;
+    }
+    edges.insert({before->second, after->second});
+  }
+  if (mInferDependencies) {
+    std::map<std::string, std::vector<size_t>> producers;
+    for (size_t i = 0; i < mProcessors.size(); i++) {
+      auto directory = mProcessors[i]->outputDirectory();
+      for (auto &name : mProcessors[i]->getOutputFileNames()) {
+        producers[pathInDirectory(directory, name)].push_back(i);
+      }
+    }
+    for (size_t i = 0; i < mProcessors.size(); i++) {
+      auto directory = mProcessors[i]->inputDirectory();
+      for (auto &name : mProcessors[i]->getInputFileNames()) {
+        auto producer = producers.find(pathInDirectory(directory, name));
+        if (producer != producers.end()) {
+          for (auto before : producer->second) {
+            if (before != i) {
+              edges.insert({before, i});
+            }
+          }
+        }
+      }
+    }
+  }
+  successors.assign(mProcessors.size(), {});
+  pending.assign(mProcessors.size(), 0);
+  for (auto &edge : edges) {
+    successors[edge.first].push_back(edge.second);
+    pending[edge.second]++;
+  }
+
+  // Check that every node can be reached through nodes without pending
+  // dependencies, otherwise there is a cycle.
+  std::vector<size_t> counts = pending;
+  std::vector<size_t> stack;
+  for (size_t i = 0; i < counts.size(); i++) {
+    if (counts[i] == 0) {
+      stack.push_back(i);
+    }
+  }
+  size_t visited = 0;
+  while (!stack.empty()) {
+    size_t node = stack.back();
+    stack.pop_back();
+    visited++;
+    for (auto successor : successors[node]) {
+      if (--counts[successor] == 0) {
+        stack.push_back(successor);
+      }
+    }
+  }
+  if (visited != mProcessors.size()) {
+    std::cerr << "ERROR: dependency cycle in chain " << id << ":";
+    for (size_t i = 0; i < counts.size(); i++) {
+      if (counts[i] > 0) {
+        std::cerr << " '" << mProcessors[i]->id << "'";
+      }
+    }
+    std::cerr << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ComputationChain::processGraph(bool forceRecompute) {
+  auto run = std::make_shared<GraphRun>();
+  if (!buildGraph(run->successors, run->pending)) {
+    return false;
+  }
+  run->nodes = mProcessors;
+  run->skipped.assign(mProcessors.size(), false);
+  run->remaining = mProcessors.size();
+  run->forceRecompute = forceRecompute;
+  for (size_t i = 0; i < mProcessors.size(); i++) {
+    if (run->pending[i] == 0) {
+      run->ready.push_back(i);
+    }
+  }
+  for (size_t i = 0; i < run->ready.size(); i++) {
+    ThreadPool::shared().submit([run]() { runReadyNode(run); });
+  }
+  // Run ready nodes on this thread too while waiting, so nested chains make
+  // progress even when all pool threads are waiting.
+  std::unique_lock<std::mutex> lk(run->lock);
+  while (run->remaining > 0) {
+    if (!run->ready.empty()) {
+      lk.unlock();
+      runReadyNode(run);
+      lk.lock();
+    } else {
+      run->changed.wait(lk);
+    }
+  }
+  return run->ok;
+}
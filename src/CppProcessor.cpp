@@ -5,7 +5,6 @@ using namespace tinc;
 CppProcessor::CppProcessor(std::string id) : Processor(id) {}
 
 bool CppProcessor::process(bool forceRecompute) {
-  PushDirectory(mRunningDirectory, mVerbose);
   if (!enabled) {
     return true;
   }
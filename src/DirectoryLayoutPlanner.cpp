@@ -0,0 +1,139 @@
+#include "tinc/DirectoryLayoutPlanner.hpp"
+
+#include "al/io/al_File.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINC_LAYOUT_PLANNER_FD
+#endif
+
+using namespace tinc;
+
+bool DirectoryLayoutPlanner::begin(std::string rootPath) {
+  end();
+  mStats = DirectoryLayoutStats();
+  mStartTime = std::chrono::steady_clock::now();
+  mRootPath = rootPath;
+  if (mRootPath.size() > 0 && !al::File::isDirectory(mRootPath)) {
+    if (!al::Dir::make(mRootPath)) {
+      std::cerr << "ERROR creating root directory: " << mRootPath << std::endl;
+      return false;
+    }
+    mStats.directoriesCreated++;
+  }
+#ifdef TINC_LAYOUT_PLANNER_FD
+  mRootFd = ::open(mRootPath.size() > 0 ? mRootPath.c_str() : ".",
+                   O_RDONLY | O_DIRECTORY);
+  if (mRootFd < 0) {
+    std::cerr << "ERROR opening directory " << mRootPath << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+#endif
+  mActive = true;
+  return true;
+}
+
+bool DirectoryLayoutPlanner::addPath(const std::string &relativePath) {
+  if (!mActive) {
+    std::cerr << "ERROR: DirectoryLayoutPlanner::begin() not called"
+              << std::endl;
+    return false;
+  }
+  mStats.pathsProcessed++;
+  mNewComponents.clear();
+  size_t start = 0;
+  while (start < relativePath.size()) {
+    size_t end = relativePath.find_first_of("/\\", start);
+    if (end == std::string::npos) {
+      end = relativePath.size();
+    }
+    if (end > start &&
+        !(end - start == 1 && relativePath[start] == '.')) {
+      mNewComponents.emplace_back(relativePath, start, end - start);
+    }
+    start = end + 1;
+  }
+
+  size_t common = 0;
+  while (common < mComponents.size() && common < mNewComponents.size() &&
+         mComponents[common] == mNewComponents[common]) {
+    common++;
+  }
+  closeFrom(common);
+
+  for (size_t i = common; i < mNewComponents.size(); i++) {
+    const std::string &name = mNewComponents[i];
+#ifdef TINC_LAYOUT_PLANNER_FD
+    int parentFd = i == 0 ? mRootFd : mFds[i - 1];
+    if (mkdirat(parentFd, name.c_str(), 0777) == 0) {
+      mStats.directoriesCreated++;
+    } else if (errno == EEXIST) {
+      mStats.directoriesExisting++;
+    } else {
+      std::cerr << "ERROR creating directory " << name << " in "
+                << mRootPath << relativePath << ": " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    int fd = openat(parentFd, name.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+      std::cerr << "ERROR opening directory " << name << " in "
+                << mRootPath << relativePath << ": " << strerror(errno)
+                << std::endl;
+      return false;
+    }
+    mFds.push_back(fd);
+#else
+    std::string path = al::File::conformPathToOS(mRootPath);
+    for (size_t j = 0; j <= i; j++) {
+      path += mNewComponents[j] + "/";
+    }
+    if (al::File::isDirectory(path)) {
+      mStats.directoriesExisting++;
+    } else if (al::Dir::make(path)) {
+      mStats.directoriesCreated++;
+    } else {
+      std::cerr << "ERROR creating directory " << path << std::endl;
+      return false;
+    }
+    mFds.push_back(-1);
+#endif
+    mComponents.push_back(name);
+  }
+  return true;
+}
+
+void DirectoryLayoutPlanner::end() {
+  closeFrom(0);
+#ifdef TINC_LAYOUT_PLANNER_FD
+  if (mRootFd >= 0) {
+    ::close(mRootFd);
+  }
+#endif
+  mRootFd = -1;
+  if (mActive) {
+    mStats.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - mStartTime)
+                         .count();
+    mActive = false;
+  }
+}
+
+void DirectoryLayoutPlanner::closeFrom(size_t depth) {
+  while (mFds.size() > depth) {
+#ifdef TINC_LAYOUT_PLANNER_FD
+    if (mFds.back() >= 0) {
+      ::close(mFds.back());
+    }
+#endif
+    mFds.pop_back();
+    mComponents.pop_back();
+  }
+}
@@ -0,0 +1,262 @@
+#include "tinc/FileHasher.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINC_FILE_HASHER_MEMO
+#endif
+
+using namespace tinc;
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// Little endian reads, independent of host byte order
+static inline uint64_t read64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static inline uint64_t read32(const unsigned char *p) {
+  return uint64_t(p[0]) | (uint64_t(p[1]) << 8) | (uint64_t(p[2]) << 16) |
+         (uint64_t(p[3]) << 24);
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+  acc += input * prime2;
+  acc = rotl(acc, 31);
+  return acc * prime1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+  acc ^= round64(0, value);
+  return acc * prime1 + prime4;
+}
+
+void HashState::reset(uint64_t seed) {
+  mSeed = seed;
+  mAcc[0] = seed + prime1 + prime2;
+  mAcc[1] = seed + prime2;
+  mAcc[2] = seed;
+  mAcc[3] = seed - prime1;
+  mTotalSize = 0;
+  mBufferSize = 0;
+}
+
+void HashState::update(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  const unsigned char *end = p + size;
+  mTotalSize += size;
+
+  if (mBufferSize + size < 32) {
+    memcpy(mBuffer + mBufferSize, p, size);
+    mBufferSize += size;
+    return;
+  }
+  if (mBufferSize > 0) {
+    size_t fill = 32 - mBufferSize;
+    memcpy(mBuffer + mBufferSize, p, fill);
+    p += fill;
+    for (int i = 0; i < 4; i++) {
+      mAcc[i] = round64(mAcc[i], read64(mBuffer + i * 8));
+    }
+    mBufferSize = 0;
+  }
+  while (p + 32 <= end) {
+    for (int i = 0; i < 4; i++) {
+      mAcc[i] = round64(mAcc[i], read64(p + i * 8));
+    }
+    p += 32;
+  }
+  mBufferSize = end - p;
+  memcpy(mBuffer, p, mBufferSize);
+}
+
+void HashState::update(uint64_t value) {
+  unsigned char bytes[8];
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = (unsigned char)(value >> (i * 8));
+  }
+  update(bytes, 8);
+}
+
+uint64_t HashState::digest() const {
+  uint64_t h;
+  if (mTotalSize >= 32) {
+    h = rotl(mAcc[0], 1) + rotl(mAcc[1], 7) + rotl(mAcc[2], 12) +
+        rotl(mAcc[3], 18);
+    for (int i = 0; i < 4; i++) {
+      h = mergeRound(h, mAcc[i]);
+    }
+  } else {
+    h = mSeed + prime5;
+  }
+  h += mTotalSize;
+
+  const unsigned char *p = mBuffer;
+  const unsigned char *end = mBuffer + mBufferSize;
+  while (p + 8 <= end) {
+    h ^= round64(0, read64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h ^= read32(p) * prime1;
+    h = rotl(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= (*p) * prime5;
+    h = rotl(h, 11) * prime1;
+    p++;
+  }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t HashState::hash(const void *data, size_t size, uint64_t seed) {
+  HashState state(seed);
+  state.update(data, size);
+  return state.digest();
+}
+
+std::string HashState::toHex(uint64_t hash) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex(16, '0');
+  for (int i = 15; i >= 0; i--) {
+    hex[i] = digits[hash & 0xF];
+    hash >>= 4;
+  }
+  return hex;
+}
+
+// --------------------------------------------------
+
+#ifdef TINC_FILE_HASHER_MEMO
+
+static int64_t modifiedNs(const struct stat &s) {
+#ifdef AL_OSX
+  return int64_t(s.st_mtimespec.tv_sec) * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+  return int64_t(s.st_mtim.tv_sec) * 1000000000 + s.st_mtim.tv_nsec;
+#endif
+}
+
+bool FileHasher::fileHash(const std::string &path, uint64_t &hash) {
+  struct stat s;
+  if (::stat(path.c_str(), &s) != 0 || !S_ISREG(s.st_mode)) {
+    return false;
+  }
+  FileId id{uint64_t(s.st_dev), uint64_t(s.st_ino)};
+  {
+    std::unique_lock<std::mutex> lk(mMemoLock);
+    auto memo = mMemo.find(id);
+    if (memo != mMemo.end() && memo->second.size == uint64_t(s.st_size) &&
+        memo->second.modifiedNs == modifiedNs(s)) {
+      hash = memo->second.hash;
+      return true;
+    }
+  }
+
+  int64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  // Identity of the file actually read, in case it was replaced after stat()
+  if (fstat(fd, &s) != 0) {
+    ::close(fd);
+    return false;
+  }
+  HashState state;
+  char buffer[1 << 16];
+  while (true) {
+    ssize_t count = ::read(fd, buffer, sizeof(buffer));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0) {
+      std::cerr << "ERROR reading " << path << ": " << strerror(errno)
+                << std::endl;
+      ::close(fd);
+      return false;
+    }
+    if (count == 0) {
+      break;
+    }
+    state.update(buffer, count);
+  }
+  ::close(fd);
+  hash = state.digest();
+
+  if (modifiedNs(s) < startNs - 1000000000) {
+    std::unique_lock<std::mutex> lk(mMemoLock);
+    if (mMemo.size() >= mMaxMemoSize) {
+      mMemo.clear();
+    }
+    id = FileId{uint64_t(s.st_dev), uint64_t(s.st_ino)};
+    mMemo[id] = FileState{uint64_t(s.st_size), modifiedNs(s), hash};
+  }
+  return true;
+}
+
+#else
+
+bool FileHasher::fileHash(const std::string &path, uint64_t &hash) {
+  std::ifstream f(path, std::ifstream::in | std::ifstream::binary);
+  if (!f.good()) {
+    return false;
+  }
+  HashState state;
+  char buffer[1 << 16];
+  while (f) {
+    f.read(buffer, sizeof(buffer));
+    state.update(buffer, size_t(f.gcount()));
+  }
+  if (f.bad()) {
+    return false;
+  }
+  hash = state.digest();
+  return true;
+}
+
+#endif
+
+void FileHasher::clear() {
+  std::unique_lock<std::mutex> lk(mMemoLock);
+  mMemo.clear();
+}
+
+size_t FileHasher::memoSize() {
+  std::unique_lock<std::mutex> lk(mMemoLock);
+  return mMemo.size();
+}
+
+FileHasher &FileHasher::shared() {
+  static FileHasher hasher;
+  return hasher;
+}
@@ -0,0 +1,130 @@
+#include "tinc/OutputCapture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace tinc;
+
+OutputCapture::OutputCapture(size_t bufferSize)
+    : mBufferSize(bufferSize > 0 ? bufferSize : 1) {}
+
+bool OutputCapture::setSpillFile(const std::string &path) {
+  if (mSpillFile) {
+    fclose(mSpillFile);
+    mSpillFile = nullptr;
+  }
+  if (path.size() == 0) {
+    return true;
+  }
+  mSpillFile = fopen(path.c_str(), "wb");
+  if (!mSpillFile) {
+    std::cerr << "ERROR opening output file: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void OutputCapture::append(CaptureStream stream, const char *data,
+                           size_t size) {
+  if (size == 0) {
+    return;
+  }
+  Stream &s = mStreams[stream];
+  s.total += size;
+  if (mSpillFile) {
+    fwrite(data, 1, size, mSpillFile);
+  }
+  if (mEcho[stream]) {
+    // Written without flushing, std::endl per line is slow for chatty
+    // processes
+    (stream == CAPTURE_ERROR ? std::cerr : std::cout).write(data, size);
+  }
+  if (mLineCallback) {
+    splitLines(stream, data, size);
+  }
+
+  // Keep the last mBufferSize bytes. The ring grows up to that size, so
+  // short outputs don't allocate the whole buffer.
+  if (s.ring.size() < mBufferSize && s.size + size > s.ring.size()) {
+    std::vector<char> ring(
+        std::min(mBufferSize, std::max(s.size + size, 2 * s.ring.size())));
+    if (s.size > 0) {
+      size_t first = std::min(s.size, s.ring.size() - s.start);
+      memcpy(ring.data(), s.ring.data() + s.start, first);
+      memcpy(ring.data() + first, s.ring.data(), s.size - first);
+    }
+    s.ring.swap(ring);
+    s.start = 0;
+  }
+  size_t capacity = s.ring.size();
+  if (size >= capacity) {
+    s.truncated = s.truncated || s.size + size > capacity;
+    memcpy(s.ring.data(), data + size - capacity, capacity);
+    s.start = 0;
+    s.size = capacity;
+    return;
+  }
+  size_t end = (s.start + s.size) % capacity;
+  size_t first = std::min(size, capacity - end);
+  memcpy(s.ring.data() + end, data, first);
+  memcpy(s.ring.data(), data + first, size - first);
+  if (s.size + size > capacity) {
+    s.truncated = true;
+    s.start = (s.start + s.size + size - capacity) % capacity;
+    s.size = capacity;
+  } else {
+    s.size += size;
+  }
+}
+
+void OutputCapture::splitLines(CaptureStream stream, const char *data,
+                               size_t size) {
+  std::string &line = mStreams[stream].line;
+  const char *end = data + size;
+  while (data < end) {
+    auto newline =
+        static_cast<const char *>(memchr(data, '\n', size_t(end - data)));
+    if (!newline) {
+      line.append(data, end);
+      if (line.size() >= mBufferSize) {
+        mLineCallback(line, stream);
+        line.clear();
+      }
+      return;
+    }
+    line.append(data, newline);
+    if (line.size() > 0 && line.back() == '\r') {
+      line.pop_back();
+    }
+    mLineCallback(line, stream);
+    line.clear();
+    data = newline + 1;
+  }
+}
+
+void OutputCapture::finish() {
+  for (int i = 0; i < 2; i++) {
+    if (mLineCallback && mStreams[i].line.size() > 0) {
+      mLineCallback(mStreams[i].line, CaptureStream(i));
+    }
+    mStreams[i].line.clear();
+  }
+  if (mEcho[CAPTURE_OUTPUT]) {
+    std::cout.flush();
+  }
+  if (mSpillFile) {
+    fclose(mSpillFile);
+    mSpillFile = nullptr;
+  }
+}
+
+std::string OutputCapture::contents(CaptureStream stream) const {
+  const Stream &s = mStreams[stream];
+  std::string data;
+  data.reserve(s.size);
+  size_t first = std::min(s.size, s.ring.size() - s.start);
+  data.append(s.ring.data() + s.start, first);
+  data.append(s.ring.data(), s.size - first);
+  return data;
+}
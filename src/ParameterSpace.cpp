@@ -1,4 +1,8 @@
 #include "tinc/ParameterSpace.hpp"
+#include "tinc/ComputationChain.hpp"
+#include "tinc/FileHasher.hpp"
+#include "tinc/ThreadPool.hpp"
+#include "tinc/SweepWorkQueue.hpp"
 
 #include "al/io/al_File.hpp"
 
@@ -7,12 +11,21 @@
 #endif
 
 #if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <dirent.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#define TINC_SCAN_DIRECTORIES
 #else
 
 #endif
 
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <thread>
 
 using namespace tinc;
 
@@ -38,10 +51,28 @@ void ParameterSpace::registerDimension(
     std::shared_ptr<ParameterSpaceDimension> dimension) {
   for (size_t i = 0; i < dimensions.size(); i++) {
     if (dimensions[i]->getName() == dimension->getName()) {
-      dimensions[i]->mValues = dimension->values();
-      dimensions[i]->mIds = dimension->ids();
+      if (dimensions[i] != dimension) {
+        // The load lock is not held while calling setLoader(), as it takes
+        // the same lock
+        std::unique_lock<std::mutex> loadLock(dimension->mLoadLock);
+        if (dimension->mLoaded) {
+          dimensions[i]->mValues = dimension->mValues;
+          dimensions[i]->mIds = dimension->mIds;
+        } else {
+          // Keep deferred loading
+          auto loader = dimension->mLoader;
+          size_t loaderSize = dimension->mLoaderSize;
+          loadLock.unlock();
+          dimensions[i]->setLoader(loaderSize, loader,
+                                   dimension->parameter().min(),
+                                   dimension->parameter().max());
+        }
+      }
       dimensions[i]->mConnectedSpaces = dimension->mConnectedSpaces;
       dimensions[i]->datatype = dimension->datatype;
+      dimensions[i]->mSorted = dimension->mSorted;
+      dimensions[i]->dataChanged();
+      clearRunPathCache();
 
       //      std::cout << "Clobbered dimension: " << dimension->getName() <<
       //      std::endl;
@@ -65,6 +96,7 @@ void ParameterSpace::registerDimension(
     this->mChangeCallback(value, dimension.get());
   });
   dimensions.push_back(dimension);
+  clearRunPathCache();
 }
 
 std::vector<std::string> ParameterSpace::runningPaths() {
@@ -89,14 +121,61 @@ std::vector<std::string> ParameterSpace::runningPaths() {
 }
 
 std::string ParameterSpace::currentRunPath() {
-  std::map<std::string, size_t> indeces;
-  for (auto ps : dimensions) {
-    if (ps->type == ParameterSpaceDimension::MAPPED ||
-        ps->type == ParameterSpaceDimension::INDEX) {
-      indeces[ps->getName()] = ps->getCurrentIndex();
+  std::string path;
+  if (generateRelativeRunPath.target<DefaultRunPathGenerator>()) {
+    std::unique_lock<std::mutex> lk(mRunPathLock);
+    size_t count = 0;
+    bool sameDimensions = true;
+    for (auto &ps : dimensions) {
+      if (ps->type == ParameterSpaceDimension::MAPPED ||
+          ps->type == ParameterSpaceDimension::INDEX) {
+        if (count >= mCurrentRunPathDimensions.size() ||
+            mCurrentRunPathDimensions[count] != ps.get()) {
+          sameDimensions = false;
+          break;
+        }
+        count++;
+      }
+    }
+    if (!sameDimensions || count != mCurrentRunPathDimensions.size()) {
+      mCurrentRunPathDimensions.clear();
+      for (auto &ps : dimensions) {
+        if (ps->type == ParameterSpaceDimension::MAPPED ||
+            ps->type == ParameterSpaceDimension::INDEX) {
+          mCurrentRunPathDimensions.push_back(ps.get());
+        }
+      }
+      // An empty list would make a cursor over all dimensions
+      auto filesystemDimensions = dimensionsForFilesystem();
+      mCurrentRunPathCursor = filesystemDimensions.size() > 0
+                                  ? createCursor(filesystemDimensions)
+                                  : SweepCursor();
+    }
+    auto &cursor = mCurrentRunPathCursor;
+    if (cursor.dimensionCount() > 0) {
+      for (size_t i = 0; i < cursor.dimensionCount(); i++) {
+        cursor.setIndex(i, cursor.dimension(i)->getCurrentIndex());
+      }
+      path = mCurrentRunPathBuilder.build(cursor);
+    }
+  } else {
+    auto getIndeces = [this]() {
+      std::map<std::string, size_t> indeces;
+      for (auto ps : dimensions) {
+        if (ps->type == ParameterSpaceDimension::MAPPED ||
+            ps->type == ParameterSpaceDimension::INDEX) {
+          indeces[ps->getName()] = ps->getCurrentIndex();
+        }
+      }
+      return indeces;
+    };
+    if (!cachedRunPath(
+            [](ParameterSpaceDimension *dim) { return dim->getCurrentIndex(); },
+            getIndeces, path)) {
+      path = generateRelativeRunPath(getIndeces());
     }
   }
-  return al::File::conformPathToOS(generateRelativeRunPath(indeces));
+  return al::File::conformPathToOS(path);
 }
 
 std::vector<std::string> ParameterSpace::dimensionNames() {
@@ -121,6 +200,7 @@ std::vector<std::string> ParameterSpace::dimensionsForFilesystem() {
 void ParameterSpace::clear() {
   dimensions.clear();
   mSpecialDirs.clear();
+  clearRunPathCache();
 }
 
 bool ParameterSpace::incrementIndeces(
@@ -138,156 +218,936 @@ bool ParameterSpace::incrementIndeces(
   return true;
 }
 
-void ParameterSpace::sweep(Processor &processor,
-                           std::vector<std::string> dimensionNames_,
-                           bool recompute) {
-  uint64_t sweepCount = 0;
-  uint64_t sweepTotal = 1;
-  mSweepRunning = true;
+SweepCursor ParameterSpace::createCursor(
+    std::vector<std::string> dimensionNames_) {
   if (dimensionNames_.size() == 0) {
     dimensionNames_ = dimensionNames();
   }
-  std::map<std::string, size_t> currentIndeces;
+  std::sort(dimensionNames_.begin(), dimensionNames_.end());
+  dimensionNames_.erase(
+      std::unique(dimensionNames_.begin(), dimensionNames_.end()),
+      dimensionNames_.end());
+  std::vector<ParameterSpaceDimension *> cursorDimensions;
+  std::vector<std::string> cursorNames;
   for (auto dimensionName : dimensionNames_) {
-    if (getDimension(dimensionName)) {
-      currentIndeces[dimensionName] = 0;
-      sweepTotal *= getDimension(dimensionName)->size();
+    auto dimension = getDimension(dimensionName);
+    if (dimension) {
+      cursorDimensions.push_back(dimension.get());
+      cursorNames.push_back(dimensionName);
     } else {
       std::cerr << __FUNCTION__
                 << " ERROR: dimension not found: " << dimensionName
                 << std::endl;
     }
   }
-  bool done = false;
-  while (!done && mSweepRunning) {
-    for (auto ps : dimensions) {
-      if (ps->type == ParameterSpaceDimension::INTERNAL) {
-        processor.configuration[ps->getName()] =
-            ps->at(currentIndeces[ps->getName()]);
-      } else if (ps->type == ParameterSpaceDimension::MAPPED) {
-        processor.configuration[ps->getName()] =
-            ps->idAt(currentIndeces[ps->getName()]);
-      } else if (ps->type == ParameterSpaceDimension::INDEX) {
-        assert(currentIndeces[ps->getName()] <
-               std::numeric_limits<int64_t>::max());
-        processor.configuration[ps->getName()] =
-            (int64_t)currentIndeces[ps->getName()];
+  return SweepCursor(cursorDimensions, cursorNames);
+}
+
+std::string ParameterSpace::relativeRunPath(const SweepCursor &cursor) {
+  if (!generateRelativeRunPath.target<DefaultRunPathGenerator>()) {
+    std::string path;
+    if (!cachedRunPath(
+            [&cursor](ParameterSpaceDimension *dim) {
+              return cursor.indexFor(dim);
+            },
+            [&cursor]() { return cursor.toMap(); }, path)) {
+      path = generateRelativeRunPath(cursor.toMap());
+    }
+    return path;
+  }
+  std::string path;
+  for (size_t i = 0; i < cursor.dimensionCount(); i++) {
+    auto id = cursor.dimension(i)->idViewAt(cursor.index(i));
+    path.append(id.data, id.size);
+    path += "/";
+  }
+  return path;
+}
+
+void ParameterSpace::setRunPathGenerator(
+    std::function<std::string(std::map<std::string, size_t>)> generator,
+    std::vector<std::string> dependencies) {
+  std::unique_lock<std::mutex> lk(mRunPathLock);
+  generateRelativeRunPath = DeclaredRunPathGenerator{generator};
+  mRunPathDependencies = dependencies;
+  mRunPathCache.clear();
+  resolveRunPathDependencies(true);
+}
+
+void ParameterSpace::clearRunPathCache() {
+  std::unique_lock<std::mutex> lk(mRunPathLock);
+  mRunPathCache.clear();
+  mRunPathDependenciesResolved = false;
+  mCurrentRunPathBuilder.reset();
+  mCurrentRunPathCursor = SweepCursor();
+  mCurrentRunPathDimensions.clear();
+}
+
+void ParameterSpace::resolveRunPathDependencies(bool reportMissing) {
+  auto names = mRunPathDependencies;
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  mRunPathDependencyDimensions.clear();
+  mRunPathDependencyVersions.clear();
+  for (auto &name : names) {
+    auto dimension = getDimension(name);
+    if (dimension) {
+      mRunPathDependencyDimensions.push_back(dimension.get());
+      mRunPathDependencyVersions.push_back(dimension->version());
+    } else if (reportMissing) {
+      std::cerr << "ERROR: run path dependency not found: " << name
+                << std::endl;
+    }
+  }
+  mRunPathDependenciesResolved = true;
+}
+
+bool ParameterSpace::cachedRunPath(
+    std::function<size_t(ParameterSpaceDimension *)> getIndex,
+    std::function<std::map<std::string, size_t>()> getIndeces,
+    std::string &path) {
+  if (!generateRelativeRunPath.target<DeclaredRunPathGenerator>()) {
+    return false;
+  }
+  uint64_t key = 0;
+  {
+    std::unique_lock<std::mutex> lk(mRunPathLock);
+    if (!mRunPathDependenciesResolved) {
+      // Missing dependencies were reported by setRunPathGenerator()
+      resolveRunPathDependencies(false);
+    }
+    // Key is the linear index of the dependencies
+    uint64_t stride = 1;
+    for (size_t i = 0; i < mRunPathDependencyDimensions.size(); i++) {
+      auto *dimension = mRunPathDependencyDimensions[i];
+      uint64_t version = dimension->version();
+      if (version != mRunPathDependencyVersions[i]) {
+        // Cached paths may use the previous values or ids
+        mRunPathCache.clear();
+        mRunPathDependencyVersions[i] = version;
       }
+      key += getIndex(dimension) * stride;
+      stride *= dimension->size();
     }
-    auto path = al::File::conformPathToOS(rootPath) +
-                generateRelativeRunPath(currentIndeces);
-    if (path.size() > 0) {
-      // TODO allow fine grained options of what directory to set
-      processor.setRunningDirectory(path);
+    auto it = mRunPathCache.find(key);
+    if (it != mRunPathCache.end()) {
+      path = it->second;
+      return true;
     }
-    if (!processor.process(recompute) && !processor.ignoreFail) {
-      std::cerr << "Processor failed in parameter sweep. Aborting" << std::endl;
-      return;
+  }
+  path = generateRelativeRunPath(getIndeces());
+  std::unique_lock<std::mutex> lk(mRunPathLock);
+  if (mRunPathCache.size() >= mRunPathCacheMaxSize) {
+    mRunPathCache.clear();
+  }
+  mRunPathCache[key] = path;
+  return true;
+}
+
+uint64_t ParameterSpace::sampleCount(std::vector<std::string> dimensionNames_) {
+  return createCursor(dimensionNames_).size();
+}
+
+uint64_t ParameterSpace::linearIndex(std::map<std::string, size_t> &indeces) {
+  uint64_t linearIndex = 0;
+  uint64_t stride = 1;
+  for (auto &dimensionIndex : indeces) {
+    auto dimension = getDimension(dimensionIndex.first);
+    if (dimension) {
+      linearIndex += dimensionIndex.second * stride;
+      stride *= dimension->size();
     }
-    sweepCount++;
-    if (onSweepProcess) {
-      onSweepProcess(currentIndeces, sweepCount / (double)sweepTotal);
+  }
+  return linearIndex;
+}
+
+std::map<std::string, size_t>
+ParameterSpace::indecesForLinearIndex(uint64_t linearIndex,
+                                      std::vector<std::string> dimensionNames_) {
+  auto cursor = createCursor(dimensionNames_);
+  if (!cursor.setLinearIndex(linearIndex)) {
+    return {};
+  }
+  return cursor.toMap();
+}
+
+std::string ParameterSpace::DefaultRunPathGenerator::operator()(
+    std::map<std::string, size_t> indeces) const {
+  std::string path;
+  for (auto dimensionSample : indeces) {
+    std::shared_ptr<ParameterSpaceDimension> dimension;
+
+    for (auto ps : space->dimensions) {
+      if (ps->parameter().getName() == dimensionSample.first) {
+        dimension = ps;
+        break;
+      }
     }
-    done = incrementIndeces(currentIndeces);
+    if (dimension) {
+      auto id = dimension->idAt(dimensionSample.second);
+      path += id + "/";
+    }
+  }
+  return path;
+}
+
+void ParameterSpace::prepareProcessor(Processor &processor,
+                                      const SweepCursor &cursor) {
+  for (auto ps : dimensions) {
+    size_t index = cursor.indexFor(ps.get());
+    if (ps->type == ParameterSpaceDimension::INTERNAL) {
+      processor.configuration[ps->getName()] = ps->at(index);
+    } else if (ps->type == ParameterSpaceDimension::MAPPED) {
+      processor.configuration[ps->getName()] = ps->idAt(index);
+    } else if (ps->type == ParameterSpaceDimension::INDEX) {
+      assert(index < std::numeric_limits<int64_t>::max());
+      processor.configuration[ps->getName()] = (int64_t)index;
+    }
+  }
+  auto path = al::File::conformPathToOS(rootPath) + relativeRunPath(cursor);
+  if (path.size() > 0) {
+    // TODO allow fine grained options of what directory to set
+    processor.setRunningDirectory(path);
   }
-  mSweepRunning = false;
 }
 
-void ParameterSpace::sweepAsync(Processor &processor,
-                                std::vector<std::string> dimensions,
+void ParameterSpace::sweep(Processor &processor,
+                           std::vector<std::string> dimensionNames_,
+                           bool recompute) {
+  SweepHandle handle;
+  runSweep({&processor}, dimensionNames_, recompute, handle);
+}
+
+void ParameterSpace::sweepRange(Processor &processor, uint64_t begin,
+                                uint64_t end,
+                                std::vector<std::string> dimensionNames_,
                                 bool recompute) {
-#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
-  pid_t pid;
-  pid = fork();
-  if (pid == -1)
-    std::cerr << "Fork failed. Could not sweep parameter space" << std::endl;
-  if (pid > 0) {
-    // Nothing to do for parent. We don't want to wait for sweep;
-  } else { // Child process
-    this->sweep(processor, dimensions, recompute);
-    exit(0); // Die immediately
+  SweepHandle handle;
+  runSweep({&processor}, dimensionNames_, recompute, handle, begin, end);
+}
+
+void ParameterSpace::sweepRange(std::vector<Processor *> processors,
+                                uint64_t begin, uint64_t end,
+                                std::vector<std::string> dimensionNames_,
+                                bool recompute) {
+  SweepHandle handle;
+  runSweep(processors, dimensionNames_, recompute, handle, begin, end);
+}
+
+bool ParameterSpace::sweepResumable(Processor &processor,
+                                    std::string journalFile,
+                                    std::vector<std::string> dimensionNames_,
+                                    bool recompute) {
+  std::string root = al::File::conformPathToOS(rootPath);
+  if (root.size() > 0 && !al::File::isDirectory(root)) {
+    if (!al::Dir::make(root)) {
+      std::cerr << "ERROR creating directory: " << root << std::endl;
+      return false;
+    }
   }
-#else
+  // The journal skips samples without checking the cache, so it must only be
+  // used for the same processor and space
+  SweepJournal journal(root + journalFile);
+  if (!journal.open(sampleCount(dimensionNames_),
+                    sweepIdentity(processor, dimensionNames_))) {
+    return false;
+  }
+  SweepHandle handle;
+  return runSweep({&processor}, dimensionNames_, recompute, handle, 0,
+                  std::numeric_limits<uint64_t>::max(), &journal);
+}
 
-  mAsyncProcessingThread = std::make_unique<std::thread>(
-      [=, &processor]() { this->sweep(processor, dimensions, recompute); });
-#endif
+// Inserts sweepId before the extension of queueFile
+static std::string queueFileWithId(std::string queueFile, uint64_t sweepId) {
+  std::string suffix = "_" + HashState::toHex(sweepId);
+  auto dot = queueFile.rfind('.');
+  auto slash = queueFile.find_last_of("/\\");
+  if (dot == std::string::npos ||
+      (slash != std::string::npos && dot < slash)) {
+    return queueFile + suffix;
+  }
+  return queueFile.insert(dot, suffix);
 }
 
-bool ParameterSpace::createDataDirectories() {
-  for (auto path : runningPaths()) {
-    if (!al::File::isDirectory(path)) {
-      if (!al::Dir::make(path)) {
-        return false;
+bool ParameterSpace::sweepSharded(Processor &processor, std::string queueFile,
+                                  uint64_t chunkSize,
+                                  std::vector<std::string> dimensionNames_,
+                                  bool recompute) {
+  std::string root = al::File::conformPathToOS(rootPath);
+  if (root.size() > 0 && !al::File::isDirectory(root)) {
+    if (!al::Dir::make(root)) {
+      std::cerr << "ERROR creating directory: " << root << std::endl;
+      return false;
+    }
+  }
+  uint64_t sweepId = sweepIdentity(processor, dimensionNames_);
+  SweepWorkQueue queue(root + queueFileWithId(queueFile, sweepId));
+  if (!queue.open(sampleCount(dimensionNames_), chunkSize, sweepId)) {
+    return false;
+  }
+  // A single handle for all chunks so stopSweep() ends the whole sweep,
+  // including the wait for other processes.
+  SweepHandle handle;
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    mActiveSweeps.push_back(&handle);
+  }
+  bool ok = true;
+  uint64_t begin, end;
+  while (true) {
+    if (queue.claimChunk(begin, end)) {
+      if (!runSweep({&processor}, dimensionNames_, recompute, handle, begin,
+                    end)) {
+        queue.releaseChunk(begin);
+        ok = false;
+        break;
       }
+      queue.completeChunk(begin);
+    } else if (queue.finished()) {
+      break;
+    } else if (handle.mCancelled) {
+      ok = false;
+      break;
+    } else {
+      // Chunks are claimed by other processes. Keep polling, as chunks of
+      // processes that die become available again.
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
   }
-  return true;
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    mActiveSweeps.erase(
+        std::find(mActiveSweeps.begin(), mActiveSweeps.end(), &handle));
+  }
+  return ok;
+}
+
+bool ParameterSpace::resetShardedSweep(Processor &processor,
+                                       std::string queueFile,
+                                       std::vector<std::string> dimensionNames_) {
+  uint64_t sweepId = sweepIdentity(processor, dimensionNames_);
+  SweepWorkQueue queue(al::File::conformPathToOS(rootPath) +
+                       queueFileWithId(queueFile, sweepId));
+  return queue.remove();
+}
+
+uint64_t ParameterSpace::sweepIdentity(Processor &processor,
+                                       std::vector<std::string> dimensionNames_) {
+  HashState hash;
+  hash.update(processor.id);
+  SweepCursor cursor = createCursor(dimensionNames_);
+  for (size_t i = 0; i < cursor.dimensionCount(); i++) {
+    auto *dimension = cursor.dimension(i);
+    hash.update(dimension->getName());
+    hash.update(uint64_t(dimension->type));
+    auto values = dimension->values();
+    hash.update(values.data(), values.size() * sizeof(float));
+    for (size_t j = 0; j < dimension->size(); j++) {
+      auto id = dimension->idViewAt(j);
+      hash.update(uint64_t(id.size));
+      hash.update(id.data, id.size);
+    }
+  }
+  return hash.digest();
+}
+
+void ParameterSpace::sweepParallel(std::vector<Processor *> processors,
+                                   std::vector<std::string> dimensionNames_,
+                                   bool recompute) {
+  SweepHandle handle;
+  runSweep(processors, dimensionNames_, recompute, handle);
+}
+
+namespace {
+
+struct PipelineItem {
+  uint64_t index;
+  bool ok{true};
+  bool skip{false};      // Remaining stages don't run
+  bool cancelled{false}; // Skipped because the sweep was aborted
+  bool prepared{true};   // The chain's prepareFunction succeeded
+};
+
+// State of a sweepPipelined() call, shared with the stage tasks
+struct Pipeline {
+  std::vector<Processor *> stages;
+  std::vector<SweepCursor> cursors;             // One per stage
+  std::vector<std::deque<PipelineItem>> queues; // Input of each stage
+  std::vector<bool> scheduled; // Stage has a task queued or running
+  size_t queueSize;
+  bool recompute;
+  bool ignoreFail; // Of the chain
+  std::function<void(Processor &, const SweepCursor &)> prepare;
+  std::function<void(const SweepCursor &)> sampleDone;
+  std::function<void(bool)> chainDone; // Calls the chain's done callbacks
+  std::atomic<bool> aborted{false};
+  size_t inFlight{0};
+  std::mutex lock;
+};
+
+void scheduleStage(const std::shared_ptr<Pipeline> &pipeline, size_t stage);
+
+// Runs samples queued for stage in order until the queue is empty or the
+// next stage's queue is full. Only one task runs per stage at a time.
+void runStage(const std::shared_ptr<Pipeline> &pipeline, size_t stage) {
+  Pipeline &p = *pipeline;
+  bool last = stage + 1 == p.stages.size();
+  std::unique_lock<std::mutex> lk(p.lock);
+  while (!p.queues[stage].empty() &&
+         (last || p.queues[stage + 1].size() < p.queueSize)) {
+    PipelineItem item = p.queues[stage].front();
+    p.queues[stage].pop_front();
+    if (stage > 0) {
+      scheduleStage(pipeline, stage - 1); // Previous stage may have stalled
+    }
+    lk.unlock();
+    SweepCursor &cursor = p.cursors[stage];
+    cursor.setLinearIndex(item.index);
+    if (p.aborted && !item.skip) {
+      item.skip = true;
+      item.cancelled = true;
+    }
+    if (!item.skip) {
+      Processor &processor = *p.stages[stage];
+      p.prepare(processor, cursor);
+      bool ok = processor.process(p.recompute);
+      item.ok &= ok;
+      if (!ok && !processor.ignoreFail) {
+        item.skip = true;
+      }
+    }
+    if (last) {
+      if (item.prepared && !item.cancelled) {
+        p.chainDone(item.ok);
+      }
+      if (!item.ok && !p.ignoreFail) {
+        if (!p.aborted.exchange(true)) {
+          std::cerr << "Processor failed in parameter sweep. Aborting"
+                    << std::endl;
+        }
+      } else if (!item.cancelled) {
+        p.sampleDone(cursor);
+      }
+    }
+    lk.lock();
+    if (last) {
+      p.inFlight--;
+    } else {
+      p.queues[stage + 1].push_back(item);
+      scheduleStage(pipeline, stage + 1);
+    }
+  }
+  p.scheduled[stage] = false;
+}
+
+// Must be called with pipeline->lock held
+void scheduleStage(const std::shared_ptr<Pipeline> &pipeline, size_t stage) {
+  Pipeline &p = *pipeline;
+  if (p.scheduled[stage] || p.queues[stage].empty()) {
+    return;
+  }
+  if (stage + 1 < p.stages.size() &&
+      p.queues[stage + 1].size() >= p.queueSize) {
+    return;
+  }
+  p.scheduled[stage] = true;
+  ThreadPool::shared().submit(
+      [pipeline, stage]() { runStage(pipeline, stage); }, pipeline.get());
+}
+
+} // namespace
+
+bool ParameterSpace::sweepPipelined(ComputationChain &chain,
+                                    std::vector<std::string> dimensionNames_,
+                                    bool recompute, size_t queueSize) {
+  if (chain.type() != ComputationChain::PROCESS_SERIAL) {
+    std::cerr << __FUNCTION__ << " ERROR: chain must be PROCESS_SERIAL"
+              << std::endl;
+    return false;
+  }
+  auto stages = chain.processors();
+  if (stages.size() == 0) {
+    std::cerr << __FUNCTION__ << " ERROR: chain has no processors"
+              << std::endl;
+    return false;
+  }
+  if (!chain.enabled) {
+    return true;
+  }
+  SweepHandle handle;
+  handle.mRunning = true;
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    mActiveSweeps.push_back(&handle);
+  }
+  SweepCursor sweepCursor = createCursor(dimensionNames_);
+  uint64_t sweepTotal = sweepCursor.size();
+  handle.mCompleted = 0;
+  handle.mTotal = sweepTotal;
+
+  auto pipeline = std::make_shared<Pipeline>();
+  pipeline->stages = stages;
+  pipeline->cursors.assign(stages.size(), sweepCursor);
+  pipeline->queues.resize(stages.size());
+  pipeline->scheduled.assign(stages.size(), false);
+  pipeline->queueSize = std::max<size_t>(queueSize, 1);
+  pipeline->recompute = recompute;
+  pipeline->ignoreFail = chain.ignoreFail;
+  pipeline->prepare = [this](Processor &processor, const SweepCursor &cursor) {
+    prepareProcessor(processor, cursor);
+  };
+  Processor *chainProcessor = &chain;
+  pipeline->chainDone = [chainProcessor](bool ok) {
+    chainProcessor->callDoneCallbacks(ok);
+  };
+  SweepHandle *handlePtr = &handle;
+  pipeline->sampleDone = [this, handlePtr,
+                          sweepTotal](const SweepCursor &cursor) {
+    // Only called from the last stage, so calls are serialized and in order
+    uint64_t sweepCount = ++handlePtr->mCompleted;
+    if (onSweepProcess) {
+      onSweepProcess(cursor.toMap(), sweepCount / (double)sweepTotal);
+    }
+  };
+
+  auto &pool = ThreadPool::shared();
+  for (uint64_t index = 0; index < sweepTotal; index++) {
+    if (!handle.waitIfPaused()) {
+      break;
+    }
+    // Wait for space in the first stage's queue
+    pool.waitUntil(
+        [&pipeline]() {
+          std::unique_lock<std::mutex> lk(pipeline->lock);
+          return pipeline->aborted ||
+                 pipeline->queues[0].size() < pipeline->queueSize;
+        },
+        {pipeline.get()});
+    if (pipeline->aborted) {
+      break;
+    }
+    PipelineItem item;
+    item.index = index;
+    sweepCursor.setLinearIndex(index);
+    prepareProcessor(chain, sweepCursor);
+    if (chain.prepareFunction && !chain.prepareFunction()) {
+      std::cerr << "ERROR preparing processor: " << chain.id << std::endl;
+      item.ok = false;
+      item.skip = true;
+      item.prepared = false;
+    }
+    std::unique_lock<std::mutex> lk(pipeline->lock);
+    pipeline->queues[0].push_back(item);
+    pipeline->inFlight++;
+    scheduleStage(pipeline, 0);
+  }
+  pool.waitUntil(
+      [&pipeline]() {
+        std::unique_lock<std::mutex> lk(pipeline->lock);
+        return pipeline->inFlight == 0;
+      },
+      {pipeline.get()});
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    mActiveSweeps.erase(
+        std::find(mActiveSweeps.begin(), mActiveSweeps.end(), &handle));
+  }
+  handle.mSuccess = !pipeline->aborted && handle.mCompleted == sweepTotal;
+  handle.mRunning = false;
+  return handle.mSuccess;
+}
+
+std::shared_ptr<SweepHandle>
+ParameterSpace::sweepAsync(Processor &processor,
+                           std::vector<std::string> dimensionNames_,
+                           bool recompute) {
+  return sweepAsync(std::vector<Processor *>{&processor}, dimensionNames_,
+                    recompute);
+}
+
+std::shared_ptr<SweepHandle>
+ParameterSpace::sweepAsync(std::vector<Processor *> processors,
+                           std::vector<std::string> dimensionNames_,
+                           bool recompute) {
+  auto handle = std::make_shared<SweepHandle>();
+  handle->mRunning = true;
+  SweepHandle *handlePtr = handle.get();
+  handle->mThread = std::thread([this, processors, dimensionNames_, recompute,
+                                 handlePtr]() {
+    this->runSweep(processors, dimensionNames_, recompute, *handlePtr);
+  });
+  std::vector<std::shared_ptr<SweepHandle>> finished;
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    // Drop handles of sweeps that have finished. They are released outside
+    // the lock, as releasing the last reference joins the sweep thread.
+    auto it = mAsyncSweeps.begin();
+    while (it != mAsyncSweeps.end()) {
+      if (!(*it)->running()) {
+        finished.push_back(*it);
+        it = mAsyncSweeps.erase(it);
+      } else {
+        it++;
+      }
+    }
+    mAsyncSweeps.push_back(handle);
+  }
+  for (auto &finishedHandle : finished) {
+    finishedHandle->join();
+  }
+  return handle;
+}
+
+bool ParameterSpace::runSweep(std::vector<Processor *> processors,
+                              std::vector<std::string> dimensionNames_,
+                              bool recompute, SweepHandle &handle,
+                              uint64_t begin, uint64_t end,
+                              SweepJournal *journal) {
+  handle.mRunning = true;
+  if (processors.size() == 0) {
+    std::cerr << __FUNCTION__ << " ERROR: no processors provided" << std::endl;
+    handle.mRunning = false;
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    mActiveSweeps.push_back(&handle);
+  }
+  SweepCursor sweepCursor = createCursor(dimensionNames_);
+  end = std::min(end, sweepCursor.size());
+  begin = std::min(begin, end);
+  uint64_t sweepTotal = end - begin;
+  handle.mCompleted = 0;
+  handle.mTotal = sweepTotal;
+  // With recompute, samples are processed again but still recorded
+  bool skipDone = journal && !recompute;
+  if (skipDone) {
+    handle.mCompleted = journal->doneCount(begin, end);
+  }
+
+  std::atomic<uint64_t> nextIndex{begin};
+  std::atomic<bool> failed{false};
+  // Serializes progress updates and calls to onSweepProcess
+  std::mutex sweepLock;
+
+  auto workerFunction = [&](Processor *processor) {
+    SweepCursor currentCursor = sweepCursor;
+    while (handle.waitIfPaused()) {
+      uint64_t index = nextIndex++;
+      if (index >= end) {
+        break;
+      }
+      if (skipDone && journal->isDone(index)) {
+        continue;
+      }
+      currentCursor.setLinearIndex(index);
+      prepareProcessor(*processor, currentCursor);
+      bool ok = processor->process(recompute);
+      if (journal) {
+        if (ok) {
+          journal->recordDone(index);
+        } else {
+          journal->recordFailed(index);
+        }
+      }
+      if (!ok && !processor->ignoreFail) {
+        std::cerr << "Processor failed in parameter sweep. Aborting"
+                  << std::endl;
+        failed = true;
+        handle.cancel();
+        break;
+      }
+      std::unique_lock<std::mutex> lk(sweepLock);
+      uint64_t sweepCount = ++handle.mCompleted;
+      if (onSweepProcess) {
+        onSweepProcess(currentCursor.toMap(),
+                       sweepCount / (double)sweepTotal);
+      }
+    }
+  };
+
+  if (processors.size() == 1) {
+    workerFunction(processors[0]);
+  } else {
+    std::vector<std::thread> workers;
+    for (auto *processor : processors) {
+      workers.emplace_back(workerFunction, processor);
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    mActiveSweeps.erase(
+        std::find(mActiveSweeps.begin(), mActiveSweeps.end(), &handle));
+  }
+  handle.mSuccess = !failed && handle.mCompleted == sweepTotal;
+  handle.mRunning = false;
+  return handle.mSuccess;
+}
+
+bool ParameterSpace::createDataDirectories(DirectoryLayoutStats *stats) {
+  DirectoryLayoutPlanner planner;
+  if (!planner.begin(rootPath)) {
+    return false;
+  }
+  bool success = true;
+  auto filesystemDimensions = dimensionsForFilesystem();
+  if (filesystemDimensions.size() > 0) {
+    // Walk the space depth first: the last dimension in the path (the deepest
+    // directory) changes fastest, so each parent is only created once.
+    SweepCursor sortedCursor = createCursor(filesystemDimensions);
+    std::vector<ParameterSpaceDimension *> layoutDimensions;
+    for (size_t i = sortedCursor.dimensionCount(); i > 0; i--) {
+      layoutDimensions.push_back(sortedCursor.dimension(i - 1));
+    }
+    SweepCursor cursor(layoutDimensions);
+    bool defaultGenerator =
+        generateRelativeRunPath.target<DefaultRunPathGenerator>() != nullptr;
+    std::string path;
+    do {
+      if (defaultGenerator) {
+        path.clear();
+        for (size_t i = cursor.dimensionCount(); i > 0; i--) {
+          auto id = cursor.dimension(i - 1)->idViewAt(cursor.index(i - 1));
+          path.append(id.data, id.size);
+          path += "/";
+        }
+      } else {
+        path = relativeRunPath(cursor);
+      }
+      if (!planner.addPath(path)) {
+        success = false;
+        break;
+      }
+    } while (!cursor.increment());
+  } else {
+    success = planner.addPath(generateRelativeRunPath({}));
+  }
+  planner.end();
+  if (stats) {
+    *stats = planner.stats();
+  }
+  return success;
 }
 
 void ParameterSpace::stopSweep() {
-  mSweepRunning = false;
-  if (mAsyncProcessingThread) {
-    mAsyncProcessingThread->join();
-    mAsyncProcessingThread = nullptr;
+  std::vector<std::shared_ptr<SweepHandle>> asyncSweeps;
+  {
+    std::unique_lock<std::mutex> lk(mSweepsLock);
+    for (auto *handle : mActiveSweeps) {
+      handle->cancel();
+    }
+    asyncSweeps = std::move(mAsyncSweeps);
+    mAsyncSweeps.clear();
+  }
+  for (auto handle : asyncSweeps) {
+    handle->cancel();
+    handle->join();
   }
 }
 
-bool readNetCDFValues(int grpid,
-                      std::shared_ptr<ParameterSpaceDimension> pdim) {
-  int retval;
-  int varid;
-  nc_type xtypep;
+// --------------------------------------------------
+
+SweepHandle::~SweepHandle() {
+  cancel();
+  join();
+}
+
+double SweepHandle::progress() {
+  if (mTotal == 0) {
+    return 1.0;
+  }
+  return mCompleted / (double)mTotal;
+}
+
+void SweepHandle::cancel() {
+  std::unique_lock<std::mutex> lk(mPauseLock);
+  mCancelled = true;
+  mPauseSignal.notify_all();
+}
+
+void SweepHandle::pause() {
+  std::unique_lock<std::mutex> lk(mPauseLock);
+  mPaused = true;
+}
+
+void SweepHandle::resume() {
+  std::unique_lock<std::mutex> lk(mPauseLock);
+  mPaused = false;
+  mPauseSignal.notify_all();
+}
+
+bool SweepHandle::paused() {
+  std::unique_lock<std::mutex> lk(mPauseLock);
+  return mPaused;
+}
+
+bool SweepHandle::join() {
+  std::unique_lock<std::mutex> lk(mJoinLock);
+  if (mThread.joinable()) {
+    mThread.join();
+  }
+  return mSuccess;
+}
+
+bool SweepHandle::waitIfPaused() {
+  std::unique_lock<std::mutex> lk(mPauseLock);
+  mPauseSignal.wait(lk, [this]() { return !mPaused || mCancelled; });
+  return !mCancelled;
+}
+
+// Reads values of type DataType in chunks, converting to float in place
+template <typename DataType>
+static bool readNetCDFConverted(int grpid, int varid, size_t length,
+                                std::vector<float> &values) {
+  const size_t chunkSize = 1 << 16;
+  std::vector<DataType> chunk(std::min(length, chunkSize));
+  for (size_t start = 0; start < length; start += chunkSize) {
+    size_t count = std::min(chunkSize, length - start);
+    if (nc_get_vara(grpid, varid, &start, &count, chunk.data())) {
+      return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+      values[start + i] = chunk[i];
+    }
+  }
+  return true;
+}
+
+// Finds the smallest and largest value reading in chunks, without keeping
+// the values
+template <typename DataType>
+static bool readNetCDFRange(int grpid, int varid, size_t length,
+                            float range[2]) {
+  const size_t chunkSize = 1 << 16;
+  std::vector<DataType> chunk(std::min(length, chunkSize));
+  range[0] = std::numeric_limits<float>::max();
+  range[1] = std::numeric_limits<float>::lowest();
+  for (size_t start = 0; start < length; start += chunkSize) {
+    size_t count = std::min(chunkSize, length - start);
+    if (nc_get_vara(grpid, varid, &start, &count, chunk.data())) {
+      return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+      range[0] = std::min(range[0], float(chunk[i]));
+      range[1] = std::max(range[1], float(chunk[i]));
+    }
+  }
+  return length > 0;
+}
+
+// Range of the 'values' variable of a dimension. Read from its actual_range
+// attribute, or from the data for files written without it.
+static bool netCDFValueRange(int grpid, int varid, nc_type xtype,
+                             size_t length, float range[2]) {
+  size_t attributeLength;
+  if (nc_inq_attlen(grpid, varid, "actual_range", &attributeLength) == 0 &&
+      attributeLength == 2 &&
+      nc_get_att_float(grpid, varid, "actual_range", range) == 0) {
+    return true;
+  }
+  if (xtype == NC_FLOAT) {
+    return readNetCDFRange<float>(grpid, varid, length, range);
+  } else if (xtype == NC_INT) {
+    return readNetCDFRange<int32_t>(grpid, varid, length, range);
+  } else if (xtype == NC_UBYTE) {
+    return readNetCDFRange<uint8_t>(grpid, varid, length, range);
+  } else if (xtype == NC_UINT) {
+    return readNetCDFRange<uint32_t>(grpid, varid, length, range);
+  }
+  return false;
+}
+
+static bool netCDFVariableLength(int grpid, const char *name, int &varid,
+                                 nc_type &xtypep, size_t &lenp) {
   int ndimsp;
   int dimidsp[32];
-  size_t lenp;
   int *nattsp = nullptr;
-  if ((retval = nc_inq_varid(grpid, "values", &varid))) {
+  if (nc_inq_varid(grpid, name, &varid)) {
     return false;
   }
-  if ((retval = nc_inq_var(grpid, varid, nullptr, &xtypep, &ndimsp, dimidsp,
-                           nattsp))) {
+  if (nc_inq_var(grpid, varid, nullptr, &xtypep, &ndimsp, dimidsp, nattsp)) {
     return false;
   }
-  if ((retval = nc_inq_dimlen(grpid, dimidsp[0], &lenp))) {
+  if (nc_inq_dimlen(grpid, dimidsp[0], &lenp)) {
     return false;
   }
+  return true;
+}
+
+// Reads 'values' and optionally 'ids' variables from a dimension group.
+// Data is written directly to the destination without intermediate copies of
+// the whole dimension.
+static bool readNetCDFDimensionData(int grpid, std::vector<float> &values,
+                                    IdStorage *ids) {
+  int varid;
+  nc_type xtypep;
+  size_t lenp;
+  if (!netCDFVariableLength(grpid, "values", varid, xtypep, lenp)) {
+    return false;
+  }
+  values.clear();
+  values.resize(lenp);
   // TODO cover all supported cases and report errors.
+  bool success = true;
   if (xtypep == NC_FLOAT) {
-    std::vector<float> data;
-    data.resize(lenp);
-    if ((retval = nc_get_var(grpid, varid, data.data()))) {
-      return false;
-    }
-    pdim->append(data.data(), data.size());
+    success = nc_get_var(grpid, varid, values.data()) == 0;
   } else if (xtypep == NC_INT) {
-
-    std::vector<int32_t> data;
-    data.resize(lenp);
-    if ((retval = nc_get_var(grpid, varid, data.data()))) {
-      return false;
-    }
-    pdim->append(data.data(), data.size());
+    success = readNetCDFConverted<int32_t>(grpid, varid, lenp, values);
   } else if (xtypep == NC_UBYTE) {
-
-    std::vector<uint8_t> data;
-    data.resize(lenp);
-    if ((retval = nc_get_var(grpid, varid, data.data()))) {
-      return false;
-    }
-    pdim->append(data.data(), data.size());
+    success = readNetCDFConverted<uint8_t>(grpid, varid, lenp, values);
   } else if (xtypep == NC_UINT) {
-
-    std::vector<uint32_t> data;
-    data.resize(lenp);
-    if ((retval = nc_get_var(grpid, varid, data.data()))) {
+    success = readNetCDFConverted<uint32_t>(grpid, varid, lenp, values);
+  } else {
+    values.clear();
+  }
+  if (!success) {
+    return false;
+  }
+  if (ids) {
+    if (!netCDFVariableLength(grpid, "ids", varid, xtypep, lenp)) {
       return false;
     }
-    pdim->append(data.data(), data.size());
+    ids->clear();
+    ids->reserve(lenp);
+    const size_t chunkSize = 1 << 14;
+    std::vector<char *> chunk(std::min(lenp, chunkSize));
+    for (size_t start = 0; start < lenp; start += chunkSize) {
+      size_t count = std::min(chunkSize, lenp - start);
+      if (nc_get_vara_string(grpid, varid, &start, &count, chunk.data())) {
+        return false;
+      }
+      for (size_t i = 0; i < count; i++) {
+        ids->push_back(chunk[i], strlen(chunk[i]));
+      }
+      nc_free_string(count, chunk.data());
+    }
   }
   return true;
 }
 
+// Loader that opens the file and reads the dimension when it is first used
+static std::function<bool(std::vector<float> &, IdStorage &)>
+netCDFDimensionLoader(std::string filename, std::string groupName,
+                      std::string dimensionName, bool readIds) {
+  return [filename, groupName, dimensionName,
+          readIds](std::vector<float> &values, IdStorage &ids) {
+    int ncid, groupid, grpid;
+    if (nc_open(filename.c_str(), NC_NOWRITE | NC_SHARE, &ncid)) {
+      std::cerr << "Error opening file: " << filename << std::endl;
+      return false;
+    }
+    bool success =
+        nc_inq_grp_ncid(ncid, groupName.c_str(), &groupid) == 0 &&
+        nc_inq_grp_ncid(groupid, dimensionName.c_str(), &grpid) == 0 &&
+        readNetCDFDimensionData(grpid, values, readIds ? &ids : nullptr);
+    nc_close(ncid);
+    return success;
+  };
+}
+
 bool ParameterSpace::readDimensionsInNetCDFFile(
     std::string filename,
     std::vector<std::shared_ptr<ParameterSpaceDimension>> &newDimensions) {
@@ -298,18 +1158,41 @@ bool ParameterSpace::readDimensionsInNetCDFFile(
   int parameters_ids[16];
   int num_conditions;
   int conditions_ids[16];
-  nc_type xtypep;
-  int ndimsp;
-  int dimidsp[32];
-  // FIXME need to check size of dimensions first
-  int *nattsp = nullptr;
-  size_t lenp;
-  int varid;
 
   int internal_state_grpid;
   int parameters_grpid;
   int conditions_grpid;
 
+  // Large dimensions are only loaded when used if lazyLoadDimensions is set
+  auto loadDimension = [&](std::shared_ptr<ParameterSpaceDimension> pdim,
+                           int grpid, std::string groupName, bool readIds) {
+    int varid;
+    nc_type xtypep;
+    size_t lenp;
+    if (!netCDFVariableLength(grpid, "values", varid, xtypep, lenp)) {
+      return false;
+    }
+    if (lazyLoadDimensions && lenp >= lazyLoadMinimumSize) {
+      auto loader =
+          netCDFDimensionLoader(filename, groupName, pdim->getName(), readIds);
+      float range[2];
+      if (netCDFValueRange(grpid, varid, xtypep, lenp, range)) {
+        pdim->setLoader(lenp, loader, range[0], range[1]);
+      } else {
+        pdim->setLoader(lenp, loader);
+      }
+      return true;
+    }
+    if (!readNetCDFDimensionData(grpid, pdim->mValues,
+                                 readIds ? &pdim->mIds : nullptr)) {
+      return false;
+    }
+    pdim->mSorted = std::is_sorted(pdim->mValues.begin(), pdim->mValues.end());
+    pdim->dataChanged();
+    pdim->conform();
+    return true;
+  };
+
   if ((retval = nc_open(filename.c_str(), NC_NOWRITE | NC_SHARE, &ncid))) {
     std::cerr << "Error opening file: " << filename << std::endl;
     return false;
@@ -332,10 +1215,10 @@ bool ParameterSpace::readDimensionsInNetCDFFile(
       std::shared_ptr<ParameterSpaceDimension> pdim =
           std::make_shared<ParameterSpaceDimension>(groupName);
 
-      if (!readNetCDFValues(state_grp_ids[i], pdim)) {
+      if (!loadDimension(pdim, state_grp_ids[i], "internal_dimensions",
+                         false)) {
         return false;
       }
-      pdim->conform();
       pdim->type = ParameterSpaceDimension::INTERNAL;
       newDimensions.push_back(pdim);
       //    std::cout << "internal state " << i << ":" << groupName
@@ -357,55 +1240,12 @@ bool ParameterSpace::readDimensionsInNetCDFFile(
       if (nc_inq_grpname(parameters_ids[i], parameterName)) {
         return false;
       }
-      if ((retval = nc_inq_varid(parameters_ids[i], "values", &varid))) {
-        return false;
-      }
-
-      if ((retval = nc_inq_var(parameters_ids[i], varid, nullptr, &xtypep,
-                               &ndimsp, dimidsp, nattsp))) {
-        return false;
-      }
-      if ((retval = nc_inq_dimlen(parameters_ids[i], dimidsp[0], &lenp))) {
-        return false;
-      }
-      std::vector<float> data;
-      data.resize(lenp);
-      if ((retval = nc_get_var(parameters_ids[i], varid, data.data()))) {
-        return false;
-      }
-      // Now get ids
-      if ((retval = nc_inq_varid(parameters_ids[i], "ids", &varid))) {
-        return false;
-      }
-
-      if ((retval = nc_inq_var(parameters_ids[i], varid, nullptr, &xtypep,
-                               &ndimsp, dimidsp, nattsp))) {
-        return false;
-      }
-      if ((retval = nc_inq_dimlen(parameters_ids[i], dimidsp[0], &lenp))) {
-        return false;
-      }
-      char totalData[lenp * 80];
-      std::vector<char *> idData;
-
-      idData.resize(lenp);
-      for (int i = 0; i < lenp; i++) {
-        idData[i] = totalData + (i * 80);
-      }
-      if ((retval =
-               nc_get_var_string(parameters_ids[i], varid, idData.data()))) {
-        return false;
-      }
-
       std::shared_ptr<ParameterSpaceDimension> pdim =
           std::make_shared<ParameterSpaceDimension>(parameterName);
-      pdim->append(data.data(), data.size());
-      pdim->mIds.resize(lenp);
-      for (int i = 0; i < lenp; i++) {
-        pdim->mIds[i] = idData[i];
+      if (!loadDimension(pdim, parameters_ids[i], "mapped_dimensions",
+                         true)) {
+        return false;
       }
-
-      pdim->conform();
       pdim->type = ParameterSpaceDimension::MAPPED;
       newDimensions.push_back(pdim);
 
@@ -431,11 +1271,10 @@ bool ParameterSpace::readDimensionsInNetCDFFile(
       std::shared_ptr<ParameterSpaceDimension> pdim =
           std::make_shared<ParameterSpaceDimension>(conditionName);
 
-      if (!readNetCDFValues(conditions_ids[i], pdim)) {
+      if (!loadDimension(pdim, conditions_ids[i], "index_dimensions", false)) {
         return false;
       }
 
-      pdim->conform();
       pdim->type = ParameterSpaceDimension::INDEX;
       newDimensions.push_back(pdim);
     }
@@ -463,12 +1302,133 @@ bool ParameterSpace::readFromNetCDF(std::string ncFile) {
     registerDimension(newDim);
   }
 
+  if (!readSpecialDirectoriesManifest(ncFile)) {
+    scanSpecialDirectories(ncFile);
+  }
+
+#else
+  std::cerr << "TINC built without NetCDF support. "
+               "ParameterSpaceDimension::loadFromNetCDF() does not work."
+            << std::endl;
+#endif
+  return true;
+}
+
+bool ParameterSpace::writeSpecialDirectoriesManifest(std::string ncFile) {
+  // Rescan only this file. Directories found for other files stay known
+  for (auto it = mSpecialDirs.begin(); it != mSpecialDirs.end();) {
+    if (it->second == ncFile) {
+      it = mSpecialDirs.erase(it);
+    } else {
+      it++;
+    }
+  }
+  scanSpecialDirectories(ncFile);
+  std::string manifestName =
+      al::File::conformPathToOS(rootPath) + ncFile + ".manifest";
+  std::ofstream manifest(manifestName);
+  if (!manifest.good()) {
+    std::cerr << "ERROR writing manifest " << manifestName << std::endl;
+    return false;
+  }
+  for (auto &specialDir : mSpecialDirs) {
+    if (specialDir.second == ncFile) {
+      manifest << specialDir.first << std::endl;
+    }
+  }
+  return manifest.good();
+}
+
+bool ParameterSpace::readSpecialDirectoriesManifest(std::string ncFile) {
+  std::ifstream manifest(al::File::conformPathToOS(rootPath) + ncFile +
+                         ".manifest");
+  if (!manifest.good()) {
+    return false;
+  }
+  std::string subPath;
+  while (std::getline(manifest, subPath)) {
+    if (subPath.size() > 0) {
+      mSpecialDirs[subPath] = ncFile;
+    }
+  }
+  return true;
+}
+
+#ifdef TINC_SCAN_DIRECTORIES
+// Depth first scan for directories containing fileName. Directories are
+// identified by device and inode to avoid loops through symbolic links.
+static void scanDirectory(const std::string &root, const std::string &subPath,
+                          const std::string &fileName, size_t depthLeft,
+                          std::set<std::pair<dev_t, ino_t>> &visited,
+                          std::map<std::string, std::string> &found) {
+  std::string path = root + subPath;
+  struct stat info;
+  if (stat(path.empty() ? "." : path.c_str(), &info) != 0 ||
+      !visited.insert({info.st_dev, info.st_ino}).second) {
+    return;
+  }
+  DIR *dir = opendir(path.empty() ? "." : path.c_str());
+  if (!dir) {
+    return;
+  }
+  std::vector<std::string> subdirectories;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if (name == fileName) {
+      if (subPath.size() > 0) {
+        found[subPath] = fileName;
+      }
+      continue;
+    }
+    if (depthLeft == 0) {
+      continue;
+    }
+    bool isDir = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (entry->d_type == DT_DIR) {
+      isDir = true;
+    } else if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      isDir = stat((path + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    }
+#else
+    isDir = stat((path + name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+    if (isDir) {
+      subdirectories.push_back(name);
+    }
+  }
+  closedir(dir);
+  for (auto &subdirectory : subdirectories) {
+    scanDirectory(root, subPath + subdirectory + AL_FILE_DELIMITER_STR,
+                  fileName, depthLeft - 1, visited, found);
+  }
+}
+#endif
+
+void ParameterSpace::scanSpecialDirectories(std::string ncFile) {
   auto dimNames = dimensionNames();
 
   std::map<std::string, size_t> currentIndeces;
   for (auto dimension : dimNames) {
     currentIndeces[dimension] = 0;
   }
+#ifdef TINC_SCAN_DIRECTORIES
+  // Parameter space files can only be found in prefixes of the run paths, so
+  // the scan doesn't need to go deeper than the number of path components.
+  size_t depth = 0;
+  std::stringstream ss(generateRelativeRunPath(currentIndeces));
+  std::string item;
+  while (std::getline(ss, item, AL_FILE_DELIMITER)) {
+    depth++;
+  }
+  std::set<std::pair<dev_t, ino_t>> visited;
+  scanDirectory(al::File::conformPathToOS(rootPath), "", ncFile, depth,
+                visited, mSpecialDirs);
+#else
   bool done = false;
   while (!done) {
     auto path = generateRelativeRunPath(currentIndeces);
@@ -486,13 +1446,7 @@ bool ParameterSpace::readFromNetCDF(std::string ncFile) {
 
     done = incrementIndeces(currentIndeces);
   }
-
-#else
-  std::cerr << "TINC built without NetCDF support. "
-               "ParameterSpaceDimension::loadFromNetCDF() does not work."
-            << std::endl;
 #endif
-  return true;
 }
 
 bool writeNetCDFValues(int datagrpid,
@@ -595,6 +1549,17 @@ bool writeNetCDFValues(int datagrpid,
 
     nc_put_var(datagrpid, varid, valuesInt.data());
   }
+  // Lets readers that load values lazily set the parameter limits
+  std::vector<float> values = ps->values();
+  if (values.size() > 0) {
+    auto range = std::minmax_element(values.begin(), values.end());
+    float actualRange[2] = {*range.first, *range.second};
+    if ((retval = nc_put_att_float(datagrpid, varid, "actual_range", NC_FLOAT,
+                                   2, actualRange))) {
+      std::cerr << nc_strerror(retval) << std::endl;
+      return false;
+    }
+  }
   return true;
 }
 
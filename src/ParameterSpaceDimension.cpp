@@ -1,8 +1,11 @@
 #include "tinc/ParameterSpaceDimension.hpp"
 
+#include <algorithm>
+
 using namespace tinc;
 
 float ParameterSpaceDimension::at(size_t x) {
+  ensureLoaded();
   if (x < mValues.size()) {
     return mValues[x];
   }
@@ -10,49 +13,148 @@ float ParameterSpaceDimension::at(size_t x) {
 }
 
 std::string ParameterSpaceDimension::idAt(size_t x) {
+  ensureLoaded();
   if (x < mIds.size()) {
-    return mIds[x];
+    return mIds.at(x).str();
   } else if (mIds.size() == 0 && x < mValues.size()) {
-    return std::to_string(mValues[x]);
+    return idViewAt(x).str();
   } else {
     return std::string();
   }
 }
 
-size_t ParameterSpaceDimension::size() { return mValues.size(); }
+IdView ParameterSpaceDimension::idViewAt(size_t x) {
+  ensureLoaded();
+  if (x < mIds.size()) {
+    return mIds.at(x);
+  } else if (mIds.size() == 0 && x < mValues.size()) {
+    std::unique_lock<std::mutex> lk(mFormattedIdsLock);
+    if (!mFormattedIdsValid) {
+      mFormattedIds.clear();
+      mFormattedIds.reserve(mValues.size(), mValues.size() * 10);
+      for (auto value : mValues) {
+        mFormattedIds.push_back(std::to_string(value));
+      }
+      mFormattedIdsValid = true;
+    }
+    return mFormattedIds.at(x);
+  } else {
+    return IdView();
+  }
+}
+
+size_t ParameterSpaceDimension::size() {
+  if (!mLoaded.load(std::memory_order_acquire)) {
+    return mLoaderSize;
+  }
+  return mValues.size();
+}
 
 void ParameterSpaceDimension::clear() {
+  {
+    std::unique_lock<std::mutex> lk(mLoadLock);
+    mLoader = nullptr;
+    mLoaded = true;
+  }
   lock();
   mParameterValue.min(FLT_MAX);
   mParameterValue.max(FLT_MIN);
   mValues.clear();
   mIds.clear();
+  mSorted = true;
+  dataChanged();
   unlock();
 }
 
 size_t ParameterSpaceDimension::getIndexForValue(float value) {
-  auto indeces = getAllIndeces(value);
+  ensureLoaded();
+  size_t lowIndex = getFirstIndexForValue(value);
+  size_t highIndex = getFirstIndexForValue(value, true);
+  if (lowIndex == highIndex) { // See getAllIndeces()
+    highIndex = lowIndex + 1;
+  }
+  if (mConnectedSpaces.size() == 0 || highIndex - lowIndex == 1) {
+    return lowIndex;
+  }
+  // Keep indeces whose ids are also present for the current value of
+  // connected spaces. Ids are compared as integer codes from the shared
+  // IdCodeTable.
+  std::vector<size_t> indeces;
+  indeces.reserve(highIndex - lowIndex);
+  for (size_t i = lowIndex; i < highIndex; i++) {
+    indeces.push_back(i);
+  }
+  std::vector<uint32_t> connectedCodes;
   for (auto connectedSpace : mConnectedSpaces) {
     if (connectedSpace->size() > 0) {
-      std::vector<std::string> ids =
-          connectedSpace->getAllIds(connectedSpace->parameter().get());
+      float connectedValue = connectedSpace->parameter().get();
+      size_t connectedLow = connectedSpace->getFirstIndexForValue(connectedValue);
+      size_t connectedHigh =
+          connectedSpace->getFirstIndexForValue(connectedValue, true);
+      if (connectedLow == connectedHigh) {
+        connectedHigh = connectedLow + 1;
+      }
+      if (connectedHigh - connectedLow == 1 &&
+          connectedSpace->idViewAt(connectedLow) == "./") {
+        continue;
+      }
+      connectedCodes = connectedSpace->idCodes(connectedLow, connectedHigh);
+      std::sort(connectedCodes.begin(), connectedCodes.end());
+      auto myCodes = idCodes(lowIndex, highIndex);
       std::vector<size_t> commonIndeces;
       for (auto index : indeces) {
-        auto id = idAt(index);
-        if (std::find(ids.begin(), ids.end(), idAt(index)) != ids.end()) {
-          commonIndeces.push_back(index);
-        } else if (ids.size() == 1 && ids[0] == "./") {
+        if (index - lowIndex < myCodes.size() &&
+            std::binary_search(connectedCodes.begin(), connectedCodes.end(),
+                               myCodes[index - lowIndex])) {
           commonIndeces.push_back(index);
         }
       }
       indeces = commonIndeces;
     }
   }
+  if (indeces.size() == 0) {
+    return lowIndex;
+  }
   return indeces[0];
 }
 
+size_t ParameterSpaceDimension::getIndexForId(const std::string &id) {
+  ensureLoaded();
+  std::unique_lock<std::mutex> lk(mIdIndexLock);
+  if (!mIdIndexValid) {
+    mIdIndex.clear();
+    mIdIndex.reserve(mValues.size());
+    for (size_t i = 0; i < mValues.size(); i++) {
+      // emplace() keeps the first index for repeated ids
+      mIdIndex.emplace(idAt(i), i);
+    }
+    mIdIndexValid = true;
+  }
+  auto it = mIdIndex.find(id);
+  if (it != mIdIndex.end()) {
+    return it->second;
+  }
+  return mValues.size();
+}
+
 size_t ParameterSpaceDimension::getFirstIndexForValue(float value,
                                                       bool reverse) {
+  ensureLoaded();
+  if (mSorted) {
+    // Binary search gives the same results as the linear search below for
+    // data in ascending order.
+    if (!reverse) {
+      auto it = std::lower_bound(mValues.begin(), mValues.end(), value);
+      if (it == mValues.end() || (it == mValues.begin() && *it != value)) {
+        return 0;
+      }
+      return std::distance(mValues.begin(), it);
+    } else {
+      value = at(getFirstIndexForValue(value));
+      auto it = std::upper_bound(mValues.begin(), mValues.end(), value);
+      return std::distance(mValues.begin(), it);
+    }
+  }
   int paramIndex = -1;
 
   if (!reverse) {
@@ -131,6 +233,12 @@ std::string ParameterSpaceDimension::getCurrentId() {
   return idAt(getCurrentIndex());
 }
 
+ParameterSpaceDimension::~ParameterSpaceDimension() {
+  if (mIdCodesValid) {
+    IdCodeTable::shared().release();
+  }
+}
+
 std::string ParameterSpaceDimension::getName() { return parameter().getName(); }
 
 std::vector<std::string> ParameterSpaceDimension::getAllCurrentIds() {
@@ -230,6 +338,10 @@ void ParameterSpaceDimension::stepDecrease() {
 }
 
 void ParameterSpaceDimension::push_back(float value, std::string id) {
+  ensureLoaded();
+  if (mValues.size() > 0 && value < mValues.back()) {
+    mSorted = false;
+  }
   mValues.emplace_back(value);
 
   if (id.size() > 0) {
@@ -247,93 +359,63 @@ void ParameterSpaceDimension::push_back(float value, std::string id) {
   if (value < mParameterValue.min()) {
     mParameterValue.min(value);
   }
+  dataChanged();
 }
 
-void ParameterSpaceDimension::append(float *values, size_t count,
-                                     std::string idprefix) {
+template <typename DataType>
+void ParameterSpaceDimension::appendValues(DataType *values, size_t count,
+                                           std::string idprefix) {
+  ensureLoaded();
   size_t oldSize = mValues.size();
-  mValues.resize(mValues.size() + count);
-  auto valueIt = mValues.begin() + oldSize;
-  auto idIt = mIds.begin() + oldSize;
   bool useIds = false;
   if (mIds.size() > 0 || idprefix.size() > 0) {
     useIds = true;
+    mIds.reserve(oldSize + count);
+    // Values added without ids get empty ids, so new ids line up with their
+    // values
+    while (mIds.size() < oldSize) {
+      mIds.push_back("", 0);
+    }
   }
+  mValues.resize(oldSize + count);
+  auto valueIt = mValues.begin() + oldSize;
   for (size_t i = 0; i < count; i++) {
     if (useIds) {
-      *idIt = idprefix + std::to_string(*values);
-      idIt++;
+      mIds.push_back(idprefix + std::to_string(*values));
     }
     *valueIt = *values;
     values++;
     valueIt++;
   }
+  if (mSorted) {
+    auto first = mValues.begin() + (oldSize > 0 ? oldSize - 1 : 0);
+    mSorted = std::is_sorted(first, mValues.end());
+  }
+  dataChanged();
+}
+
+void ParameterSpaceDimension::append(float *values, size_t count,
+                                     std::string idprefix) {
+  appendValues(values, count, idprefix);
 }
 
 void ParameterSpaceDimension::append(int32_t *values, size_t count,
                                      std::string idprefix) {
-  size_t oldSize = mValues.size();
-  mValues.resize(mValues.size() + count);
-  auto valueIt = mValues.begin() + oldSize;
-  auto idIt = mIds.begin() + oldSize;
-  bool useIds = false;
-  if (mIds.size() > 0 || idprefix.size() > 0) {
-    useIds = true;
-  }
-  for (size_t i = 0; i < count; i++) {
-    if (useIds) {
-      *idIt = idprefix + std::to_string(*values);
-      idIt++;
-    }
-    *valueIt = *values;
-    values++;
-    valueIt++;
-  }
+  appendValues(values, count, idprefix);
 }
 
 void ParameterSpaceDimension::append(uint32_t *values, size_t count,
                                      std::string idprefix) {
-  size_t oldSize = mValues.size();
-  mValues.resize(mValues.size() + count);
-  auto valueIt = mValues.begin() + oldSize;
-  auto idIt = mIds.begin() + oldSize;
-  bool useIds = false;
-  if (mIds.size() > 0 || idprefix.size() > 0) {
-    useIds = true;
-  }
-  for (size_t i = 0; i < count; i++) {
-    if (useIds) {
-      *idIt = idprefix + std::to_string(*values);
-      idIt++;
-    }
-    *valueIt = *values;
-    values++;
-    valueIt++;
-  }
+  appendValues(values, count, idprefix);
 }
 
 void ParameterSpaceDimension::append(uint8_t *values, size_t count,
                                      std::string idprefix) {
-  size_t oldSize = mValues.size();
-  mValues.resize(mValues.size() + count);
-  auto valueIt = mValues.begin() + oldSize;
-  auto idIt = mIds.begin() + oldSize;
-  bool useIds = false;
-  if (mIds.size() > 0 || idprefix.size() > 0) {
-    useIds = true;
-  }
-  for (size_t i = 0; i < count; i++) {
-    if (useIds) {
-      *idIt = idprefix + std::to_string(*values);
-      idIt++;
-    }
-    *valueIt = *values;
-    values++;
-    valueIt++;
-  }
+  appendValues(values, count, idprefix);
 }
 
 void ParameterSpaceDimension::conform() {
+  ensureLoaded();
   mParameterValue.max(std::numeric_limits<float>::min());
   mParameterValue.min(std::numeric_limits<float>::max());
   for (auto value : mValues) {
@@ -348,6 +430,7 @@ void ParameterSpaceDimension::conform() {
 }
 
 void ParameterSpaceDimension::reserve(size_t totalSize) {
+  ensureLoaded();
   mValues.reserve(totalSize);
 }
 
@@ -356,6 +439,56 @@ void ParameterSpaceDimension::addConnectedParameterSpace(
   mConnectedSpaces.push_back(paramSpace);
 }
 
+uint32_t ParameterSpaceDimension::IdCodeTable::code(const std::string &id) {
+  std::unique_lock<std::mutex> lk(lock);
+  auto it = codes.find(id);
+  if (it != codes.end()) {
+    return it->second;
+  }
+  uint32_t newCode = (uint32_t)codes.size();
+  codes[id] = newCode;
+  return newCode;
+}
+
+void ParameterSpaceDimension::IdCodeTable::acquire() {
+  std::unique_lock<std::mutex> lk(lock);
+  holders++;
+}
+
+void ParameterSpaceDimension::IdCodeTable::release() {
+  std::unique_lock<std::mutex> lk(lock);
+  if (--holders == 0) {
+    // No codes are left to compare with, so codes can be handed out again
+    codes.clear();
+  }
+}
+
+ParameterSpaceDimension::IdCodeTable &
+ParameterSpaceDimension::IdCodeTable::shared() {
+  // Never destroyed, so dimensions destroyed at exit can still release codes
+  static IdCodeTable *table = new IdCodeTable;
+  return *table;
+}
+
+std::vector<uint32_t> ParameterSpaceDimension::idCodes(size_t begin,
+                                                       size_t end) {
+  ensureLoaded();
+  std::unique_lock<std::mutex> lk(mIdIndexLock);
+  if (!mIdCodesValid) {
+    auto &table = IdCodeTable::shared();
+    mIdCodes.resize(mValues.size());
+    table.acquire();
+    for (size_t i = 0; i < mValues.size(); i++) {
+      mIdCodes[i] = table.code(idAt(i));
+    }
+    mIdCodesValid = true;
+  }
+  end = std::min(end, mIdCodes.size());
+  begin = std::min(begin, end);
+  return std::vector<uint32_t>(mIdCodes.begin() + begin,
+                               mIdCodes.begin() + end);
+}
+
 class sort_indices {
 private:
   float *mFloatArray;
@@ -368,6 +501,7 @@ public:
 };
 
 void ParameterSpaceDimension::sort() {
+  ensureLoaded();
   lock();
 
   std::vector<size_t> indeces;
@@ -377,9 +511,9 @@ void ParameterSpaceDimension::sort() {
   }
   std::sort(indeces.begin(), indeces.end(), sort_indices(mValues.data()));
   std::vector<float> newValues;
-  std::vector<std::string> newIds;
+  IdStorage newIds;
   newValues.reserve(indeces.size());
-  newIds.reserve(indeces.size());
+  newIds.reserve(mIds.size());
   if (mValues.size() != mIds.size() && mIds.size() > 0) {
     std::cerr << "ERROR: sort() will crash (or lead ot unexpected behavior) as "
                  "the size of values and ids don't match."
@@ -388,15 +522,110 @@ void ParameterSpaceDimension::sort() {
   for (size_t i = 0; i < indeces.size(); i++) {
     size_t index = indeces[i];
     newValues.push_back(mValues[index]);
-    if (mIds.size() > 0) {
-      newIds.push_back(mIds[index]);
+    if (index < mIds.size()) {
+      auto id = mIds.at(index);
+      newIds.push_back(id.data, id.size);
     }
   }
   mValues = newValues;
   mIds = newIds;
+  mSorted = true;
+  dataChanged();
   unlock();
 }
 
-std::vector<float> ParameterSpaceDimension::values() { return mValues; }
+void ParameterSpaceDimension::setLoader(
+    size_t size, std::function<bool(std::vector<float> &, IdStorage &)> loader) {
+  std::unique_lock<std::mutex> lk(mLoadLock);
+  mValues.clear();
+  mIds.clear();
+  mLoader = loader;
+  mLoaderSize = size;
+  mLoaded = false;
+  dataChanged();
+}
+
+void ParameterSpaceDimension::setLoader(
+    size_t size, std::function<bool(std::vector<float> &, IdStorage &)> loader,
+    float min, float max) {
+  setLoader(size, loader);
+  mParameterValue.min(min);
+  mParameterValue.max(max);
+}
+
+void ParameterSpaceDimension::load() {
+  std::unique_lock<std::mutex> lk(mLoadLock);
+  if (mLoaded) {
+    return;
+  }
+  std::vector<float> values;
+  IdStorage ids;
+  if (mLoader && !mLoader(values, ids)) {
+    std::cerr << "ERROR loading data for dimension " << getName() << std::endl;
+    values.clear();
+    ids.clear();
+  }
+  if (ids.size() > 0 && ids.size() != values.size()) {
+    std::cerr << " ERROR! value and id mismatch in parameter space! This is bad."
+              << std::endl;
+  }
+  mLoader = nullptr;
+  mValues = std::move(values);
+  mIds = std::move(ids);
+  mSorted = std::is_sorted(mValues.begin(), mValues.end());
+  dataChanged();
+  mLoaded.store(true, std::memory_order_release);
+  conform();
+}
+
+void ParameterSpaceDimension::dataChanged() {
+  mVersion++;
+  std::unique_lock<std::mutex> lk(mIdIndexLock);
+  mIdIndexValid = false;
+  mIdIndex.clear();
+  if (mIdCodesValid) {
+    IdCodeTable::shared().release();
+    mIdCodesValid = false;
+  }
+  std::unique_lock<std::mutex> lk2(mFormattedIdsLock);
+  mFormattedIdsValid = false;
+  mFormattedIds.clear();
+}
 
-std::vector<std::string> ParameterSpaceDimension::ids() { return mIds; }
+std::vector<float> ParameterSpaceDimension::values() {
+  ensureLoaded();
+  return mValues;
+}
+
+std::vector<std::string> ParameterSpaceDimension::ids() {
+  ensureLoaded();
+  std::vector<std::string> ids;
+  ids.reserve(mIds.size());
+  for (size_t i = 0; i < mIds.size(); i++) {
+    ids.push_back(mIds.at(i).str());
+  }
+  return ids;
+}
+
+// --------------------------------------------------
+
+void IdStorage::reserve(size_t count, size_t totalLength) {
+  mOffsets.reserve(count + 1);
+  if (totalLength > 0) {
+    mBuffer.reserve(totalLength);
+  }
+}
+
+void IdStorage::clear() {
+  mBuffer.clear();
+  mOffsets.resize(1);
+}
+
+void IdStorage::push_back(const std::string &id) {
+  push_back(id.data(), id.size());
+}
+
+void IdStorage::push_back(const char *id, size_t length) {
+  mBuffer.insert(mBuffer.end(), id, id + length);
+  mOffsets.push_back(mBuffer.size());
+}
@@ -0,0 +1,252 @@
+#include "tinc/ProcessFuture.hpp"
+#include "tinc/Processor.hpp"
+#include "tinc/ThreadPool.hpp"
+
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <unordered_set>
+
+using namespace tinc;
+
+// Each state is the ThreadPool group of the tasks that complete it
+struct ProcessFuture::State {
+  struct Callback {
+    std::function<void(const ProcessResult &)> function;
+    const void *group;
+  };
+
+  std::mutex lock;
+  bool done{false};
+  ProcessResult result;
+  std::vector<Callback> callbacks;
+  // Futures this one waits for. Released once done
+  std::vector<std::shared_ptr<State>> dependencies;
+};
+
+namespace {
+
+// Result of waiting on or chaining to a future without a state
+ProcessResult invalidResult() {
+  ProcessResult result;
+  result.error = "Invalid future";
+  return result;
+}
+
+ProcessResult callProcessor(Processor &processor, bool forceRecompute) {
+  ProcessResult result;
+  result.processorId = processor.id;
+  auto start = std::chrono::steady_clock::now();
+  try {
+    result.ok = processor.process(forceRecompute);
+    if (!result.ok) {
+      result.error = processor.lastError();
+    }
+  } catch (std::exception &e) {
+    result.ok = false;
+    result.error = e.what();
+  } catch (...) {
+    result.ok = false;
+    result.error = "Unknown exception";
+  }
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  if (!result.ok && result.error.size() == 0) {
+    result.error = "Processor '" + processor.id + "' failed";
+  }
+  return result;
+}
+
+} // namespace
+
+bool ProcessFuture::ready() const {
+  if (!mState) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lk(mState->lock);
+  return mState->done;
+}
+
+ProcessResult ProcessFuture::get() const {
+  if (!mState) {
+    return invalidResult();
+  }
+  auto state = mState;
+  // Groups of the pending futures this result depends on
+  std::vector<std::shared_ptr<State>> graph{state};
+  std::unordered_set<const void *> groups{state.get()};
+  for (size_t i = 0; i < graph.size(); i++) {
+    std::unique_lock<std::mutex> lk(graph[i]->lock);
+    for (auto &dependency : graph[i]->dependencies) {
+      if (groups.insert(dependency.get()).second) {
+        graph.push_back(dependency);
+      }
+    }
+  }
+  ThreadPool::shared().waitUntil(
+      [state]() {
+        std::unique_lock<std::mutex> lk(state->lock);
+        return state->done;
+      },
+      std::vector<const void *>(groups.begin(), groups.end()));
+  std::unique_lock<std::mutex> lk(state->lock);
+  return state->result;
+}
+
+ProcessFuture
+ProcessFuture::then(std::function<bool(const ProcessResult &)> continuation) {
+  if (!valid()) {
+    return completed(invalidResult()).then(continuation);
+  }
+  ProcessFuture next;
+  next.mState = std::make_shared<State>();
+  next.mState->dependencies.push_back(mState);
+  auto nextState = next.mState;
+  auto callback = [continuation, nextState](const ProcessResult &previous) {
+    ProcessResult result;
+    auto start = std::chrono::steady_clock::now();
+    try {
+      result.ok = continuation(previous);
+    } catch (std::exception &e) {
+      result.error = e.what();
+    } catch (...) {
+      result.error = "Unknown exception";
+    }
+    result.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    if (!result.ok && result.error.size() == 0) {
+      result.error = "Continuation failed";
+    }
+    complete(nextState, result);
+  };
+  onDone(callback, nextState.get());
+  return next;
+}
+
+ProcessFuture ProcessFuture::then(Processor &processor, bool forceRecompute) {
+  if (!valid()) {
+    return completed(invalidResult()).then(processor, forceRecompute);
+  }
+  ProcessFuture next;
+  next.mState = std::make_shared<State>();
+  next.mState->dependencies.push_back(mState);
+  auto nextState = next.mState;
+  Processor *nextProcessor = &processor;
+  auto callback = [nextProcessor, forceRecompute,
+                   nextState](const ProcessResult &previous) {
+    if (!previous.ok) {
+      ProcessResult result = previous;
+      result.processorId = nextProcessor->id;
+      result.seconds = 0.0;
+      complete(nextState, result);
+      return;
+    }
+    complete(nextState, callProcessor(*nextProcessor, forceRecompute));
+  };
+  onDone(callback, nextState.get());
+  return next;
+}
+
+ProcessFuture ProcessFuture::whenAll(std::vector<ProcessFuture> futures) {
+  if (futures.size() == 0) {
+    ProcessResult result;
+    result.ok = true;
+    return completed(result);
+  }
+  struct Gather {
+    std::mutex lock;
+    size_t remaining;
+    ProcessResult result;
+  };
+  auto gather = std::make_shared<Gather>();
+  gather->remaining = futures.size();
+  gather->result.ok = true;
+
+  ProcessFuture all;
+  all.mState = std::make_shared<State>();
+  auto allState = all.mState;
+  for (auto &future : futures) {
+    if (!future.valid()) {
+      future = completed(invalidResult());
+    }
+    allState->dependencies.push_back(future.mState);
+  }
+  auto callback = [gather, allState](const ProcessResult &result) {
+    std::unique_lock<std::mutex> lk(gather->lock);
+    gather->result.ok &= result.ok;
+    gather->result.seconds += result.seconds;
+    if (result.error.size() > 0) {
+      if (gather->result.error.size() > 0) {
+        gather->result.error += "\n";
+      }
+      gather->result.error += result.error;
+    }
+    if (--gather->remaining == 0) {
+      ProcessResult combined = gather->result;
+      lk.unlock();
+      complete(allState, combined);
+    }
+  };
+  for (auto &future : futures) {
+    future.onDone(callback, allState.get());
+  }
+  return all;
+}
+
+ProcessFuture ProcessFuture::run(Processor &processor, bool forceRecompute) {
+  ProcessFuture future;
+  future.mState = std::make_shared<State>();
+  auto state = future.mState;
+  Processor *p = &processor;
+  ThreadPool::shared().submit(
+      [p, forceRecompute, state]() {
+        complete(state, callProcessor(*p, forceRecompute));
+      },
+      state.get());
+  return future;
+}
+
+ProcessFuture ProcessFuture::completed(ProcessResult result) {
+  ProcessFuture future;
+  future.mState = std::make_shared<State>();
+  future.mState->done = true;
+  future.mState->result = result;
+  return future;
+}
+
+void ProcessFuture::onDone(std::function<void(const ProcessResult &)> callback,
+                           const void *group) const {
+  {
+    std::unique_lock<std::mutex> lk(mState->lock);
+    if (!mState->done) {
+      mState->callbacks.push_back({callback, group});
+      return;
+    }
+  }
+  auto state = mState;
+  ThreadPool::shared().submit(
+      [state, callback]() {
+        callback(state->result); // result doesn't change once done
+      },
+      group);
+}
+
+void ProcessFuture::complete(const std::shared_ptr<State> &state,
+                             ProcessResult result) {
+  std::vector<State::Callback> callbacks;
+  std::vector<std::shared_ptr<State>> dependencies;
+  {
+    std::unique_lock<std::mutex> lk(state->lock);
+    state->result = result;
+    state->done = true;
+    callbacks.swap(state->callbacks);
+    dependencies.swap(state->dependencies);
+  }
+  for (auto &callback : callbacks) {
+    auto function = callback.function;
+    ThreadPool::shared().submit(
+        [state, function]() { function(state->result); }, callback.group);
+  }
+}
@@ -1,8 +1,12 @@
 #include "tinc/Processor.hpp"
+#include "tinc/ThreadPool.hpp"
 
 #include "al/io/al_File.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <mutex>
 
 // For PushDirectory
 #if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
@@ -87,6 +91,19 @@ void Processor::setRunningDirectory(std::string directory) {
   }
 }
 
+std::string Processor::pathInDirectory(const std::string &directory,
+                                       const std::string &fileName) {
+  bool absolute = fileName.size() > 0 && (fileName[0] == '/' ||
+                                          fileName[0] == '\\');
+#ifdef AL_WINDOWS
+  absolute = absolute || (fileName.size() > 1 && fileName[1] == ':');
+#endif
+  if (absolute || directory.size() == 0) {
+    return fileName;
+  }
+  return al::File::conformPathToOS(directory) + fileName;
+}
+
 void Processor::setOutputFileNames(std::vector<std::string> outputFiles) {
   mOutputFileNames.clear();
   for (auto fileName : outputFiles) {
@@ -112,3 +129,158 @@ void Processor::setInputFileNames(std::vector<std::string> inputFiles) {
 std::vector<std::string> Processor::getInputFileNames() {
   return mInputFileNames;
 }
+
+struct Processor::CoalesceState {
+  std::mutex lock;
+  std::map<std::string, Flag> pending; // Changes not yet in configuration
+  bool dirty{false};     // Changes arrived since the last run started
+  bool scheduled{false}; // A run is queued, delayed or running
+  bool running{false};
+  uint64_t generation{0};          // Number of the current or last run
+  uint64_t cancelledGeneration{0}; // Last run asked to stop
+  double debounceSeconds{0.0};
+  bool cancelStale{true};
+  std::chrono::steady_clock::time_point lastChange;
+  CoalescingStats stats;
+  double totalSeconds{0.0};
+};
+
+void Processor::setCoalescing(bool coalesce, double debounceSeconds,
+                              bool cancelStale) {
+  auto state = std::atomic_load(&mScheduling.coalesce);
+  if (coalesce) {
+    if (state) {
+      std::unique_lock<std::mutex> lk(state->lock);
+      state->debounceSeconds = debounceSeconds;
+      state->cancelStale = cancelStale;
+      return;
+    }
+    state = std::make_shared<CoalesceState>();
+    state->debounceSeconds = debounceSeconds;
+    state->cancelStale = cancelStale;
+    std::atomic_store(&mScheduling.coalesce, state);
+  } else if (state) {
+    waitForCoalesced();
+    std::atomic_store(&mScheduling.coalesce,
+                      std::shared_ptr<CoalesceState>());
+  }
+}
+
+void Processor::waitForCoalesced() {
+  auto state = std::atomic_load(&mScheduling.coalesce);
+  if (!state) {
+    return;
+  }
+  ThreadPool::shared().waitUntil(
+      [state]() {
+        std::unique_lock<std::mutex> lk(state->lock);
+        return !state->scheduled;
+      },
+      {state.get()});
+}
+
+bool Processor::cancelsStaleRuns() {
+  auto state = std::atomic_load(&mScheduling.coalesce);
+  if (!state) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lk(state->lock);
+  return state->cancelStale;
+}
+
+CoalescingStats Processor::coalescingStats() {
+  auto state = std::atomic_load(&mScheduling.coalesce);
+  if (!state) {
+    return CoalescingStats();
+  }
+  std::unique_lock<std::mutex> lk(state->lock);
+  return state->stats;
+}
+
+void Processor::resetCoalescingStats() {
+  auto state = std::atomic_load(&mScheduling.coalesce);
+  if (state) {
+    std::unique_lock<std::mutex> lk(state->lock);
+    state->stats = CoalescingStats();
+    state->totalSeconds = 0.0;
+  }
+}
+
+void Processor::parameterChanged(const std::string &name, Flag value) {
+  auto state = std::atomic_load(&mScheduling.coalesce);
+  if (!state) {
+    configuration[name] = value;
+    process();
+    return;
+  }
+  std::unique_lock<std::mutex> lk(state->lock);
+  state->pending[name] = value;
+  state->lastChange = std::chrono::steady_clock::now();
+  state->stats.changes++;
+  state->dirty = true;
+  // Cancelled with the lock held, so the request can only reach the run this
+  // change makes stale. dirty makes sure another run follows it.
+  if (state->running && state->cancelStale &&
+      state->cancelledGeneration != state->generation) {
+    state->cancelledGeneration = state->generation;
+    requestCancel();
+  }
+  if (!state->scheduled) {
+    state->scheduled = true;
+    ThreadPool::shared().submitAfter(
+        state->debounceSeconds, [this, state]() { runCoalesced(state); },
+        state.get());
+  }
+}
+
+void Processor::runCoalesced(std::shared_ptr<CoalesceState> state) {
+  std::chrono::steady_clock::time_point changeTime;
+  uint64_t generation;
+  {
+    std::unique_lock<std::mutex> lk(state->lock);
+    std::chrono::duration<double> quiet =
+        std::chrono::steady_clock::now() - state->lastChange;
+    if (quiet.count() < state->debounceSeconds) {
+      // Changed again while waiting
+      ThreadPool::shared().submitAfter(
+          state->debounceSeconds - quiet.count(),
+          [this, state]() { runCoalesced(state); }, state.get());
+      return;
+    }
+    for (auto &change : state->pending) {
+      configuration[change.first] = change.second;
+    }
+    state->pending.clear();
+    state->dirty = false;
+    state->running = true;
+    generation = ++state->generation;
+    clearCancelRequest();
+    changeTime = state->lastChange;
+  }
+  process();
+  std::chrono::duration<double> latency =
+      std::chrono::steady_clock::now() - changeTime;
+
+  std::unique_lock<std::mutex> lk(state->lock);
+  state->running = false;
+  state->stats.runs++;
+  if (state->dirty) {
+    // Result is already stale
+    if (state->cancelledGeneration == generation) {
+      state->stats.cancelled++;
+    }
+    std::chrono::duration<double> quiet =
+        std::chrono::steady_clock::now() - state->lastChange;
+    ThreadPool::shared().submitAfter(
+        std::max(0.0, state->debounceSeconds - quiet.count()),
+        [this, state]() { runCoalesced(state); }, state.get());
+    return;
+  }
+  auto &stats = state->stats;
+  stats.results++;
+  stats.lastSeconds = latency.count();
+  stats.maxSeconds = std::max(stats.maxSeconds, latency.count());
+  state->totalSeconds += latency.count();
+  stats.meanSeconds = state->totalSeconds / stats.results;
+  state->scheduled = false;
+}
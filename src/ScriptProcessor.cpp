@@ -1,23 +1,38 @@
 
 #include "tinc/ScriptProcessor.hpp"
+#include "tinc/FileHasher.hpp"
+#include "tinc/ParameterSpace.hpp"
+#include "tinc/ThreadPool.hpp"
 
 #include "nlohmann/json.hpp"
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iomanip> // setprecision
 #include <iostream>
 #include <mutex>
+#include <sstream>
 #include <thread>
+#include <unordered_set>
 #include <utility> // For pair
 
 #if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#define TINC_SPAWN_PROCESSES
 #elif defined(AL_WINDOWS)
 #include <Windows.h>
 #include <direct.h> // for _chdir() and _getcwd()
@@ -31,9 +46,15 @@
 
 using namespace tinc;
 
-constexpr auto DATASCRIPT_META_FORMAT_VERSION = 0;
+constexpr auto DATASCRIPT_META_FORMAT_VERSION = 1;
 
-std::string ScriptProcessor::scriptFile(bool fullPath) { return mScriptName; }
+std::string ScriptProcessor::scriptFile(bool fullPath) {
+  if (fullPath) {
+    // Script is run from the running directory
+    return pathInDirectory(mRunningDirectory, mScriptName);
+  }
+  return mScriptName;
+}
 
 std::string ScriptProcessor::inputFile(bool fullPath, int index) {
   std::string inputName;
@@ -42,7 +63,7 @@ std::string ScriptProcessor::inputFile(bool fullPath, int index) {
   }
 
   if (fullPath) {
-    return runningDirectory() + inputName;
+    return pathInDirectory(inputDirectory(), inputName);
   } else {
     return inputName;
   }
@@ -80,12 +101,18 @@ bool ScriptProcessor::process(bool forceRecompute) {
     return false;
   }
   bool ok = true;
-  if (needsRecompute() || forceRecompute) {
-    std::string command =
-        mScriptCommand + " \"" + mScriptName + "\" \"" + jsonFilename + "\"";
-    ok = runCommand(command);
+  auto key = cacheKey();
+  if (forceRecompute || needsRecompute(key)) {
+    auto startTime = std::chrono::steady_clock::now();
+    if (mWorkerPool || mPersistentWorkers > 0) {
+      ok = runJob(jsonFilename);
+    } else {
+      ok = runCommand(scriptArguments(jsonFilename), mRunningDirectory);
+    }
     if (ok) {
-      writeMeta();
+      std::chrono::duration<double> computeTime =
+          std::chrono::steady_clock::now() - startTime;
+      writeMeta(key, computeTime.count());
     }
   } else {
     if (mVerbose) {
@@ -109,8 +136,10 @@ bool ScriptProcessor::processAsync(bool noWait,
                                    std::function<void(bool)> doneCallback) {
   std::lock_guard<std::mutex> lk(mProcessingLock);
 
-  if (needsRecompute()) {
-    std::string command = makeCommandLine();
+  auto key = cacheKey();
+  if (needsRecompute(key)) {
+    auto arguments = makeCommandArguments();
+    std::string directory = mRunningDirectory;
     while (mNumAsyncProcesses.fetch_add(1) > mMaxAsyncProcesses) {
       mNumAsyncProcesses--;
       if (noWait) {
@@ -122,8 +151,15 @@ bool ScriptProcessor::processAsync(bool noWait,
       std::cout << "Async done waiting 2 " << mNumAsyncProcesses << std::endl;
     }
     //            std::cout << "Async " << mNumAsyncProcesses << std::endl;
-    mAsyncThreads.emplace_back(std::thread([this, command, doneCallback]() {
-      bool ok = runCommand(command);
+    auto task = [this, key, arguments, directory, doneCallback]() {
+      auto startTime = std::chrono::steady_clock::now();
+      bool ok = runCommand(arguments, directory);
+      if (ok) {
+        std::chrono::duration<double> computeTime =
+            std::chrono::steady_clock::now() - startTime;
+        std::lock_guard<std::mutex> lk(mProcessingLock);
+        writeMeta(key, computeTime.count());
+      }
 
       if (doneCallback) {
         doneCallback(ok);
@@ -132,10 +168,8 @@ bool ScriptProcessor::processAsync(bool noWait,
       mAsyncDoneTrigger.notify_all();
       //                std::cout << "Async runner done" << mNumAsyncProcesses
       //                << std::endl;
-    }));
-
-    PushDirectory p(mRunningDirectory, mVerbose);
-    writeMeta();
+    };
+    ThreadPool::shared().submit(task, this);
   } else {
     if (doneCallback) {
       doneCallback(true);
@@ -149,7 +183,7 @@ bool ScriptProcessor::processAsync(std::map<std::string, std::string> options,
                                    std::function<void(bool)> doneCallback) {
   std::unique_lock<std::mutex> lk(mProcessingLock);
 
-  if (needsRecompute()) {
+  if (needsRecompute(cacheKey())) {
     lk.unlock();
     while (mNumAsyncProcesses.fetch_add(1) > mMaxAsyncProcesses) {
       mNumAsyncProcesses--;
@@ -166,12 +200,10 @@ bool ScriptProcessor::processAsync(std::map<std::string, std::string> options,
     if (mVerbose) {
       std::cout << "Starting asyc thread" << std::endl;
     }
-    mAsyncThreads.emplace_back(std::thread([this, doneCallback]() {
+    auto task = [this, doneCallback]() {
+      // process() writes the metadata when the script succeeds
       bool ok = process(true);
 
-      PushDirectory p(mRunningDirectory, mVerbose);
-      writeMeta();
-
       if (doneCallback) {
         doneCallback(ok);
       }
@@ -179,7 +211,8 @@ bool ScriptProcessor::processAsync(std::map<std::string, std::string> options,
       mAsyncDoneTrigger.notify_all();
       //                std::cout << "Async runner done" <<
       //                mNumAsyncProcesses << std::endl;
-    }));
+    };
+    ThreadPool::shared().submit(task, this);
   } else {
     doneCallback(true);
   }
@@ -195,16 +228,13 @@ bool ScriptProcessor::runningAsync() {
 }
 
 bool ScriptProcessor::waitForAsyncDone() {
-  bool ok = true;
-  for (auto &t : mAsyncThreads) {
-    t.join();
-  }
-  return ok;
+  ThreadPool::shared().waitUntil(
+      [this]() { return mNumAsyncProcesses <= 0; }, {this});
+  return true;
 }
 
-std::string ScriptProcessor::writeJsonConfig() {
-  using json = nlohmann::json;
-  json j;
+nlohmann::json ScriptProcessor::configJson() {
+  nlohmann::json j;
 
   j["__tinc_metadata_version"] = DATASCRIPT_META_FORMAT_VERSION;
   j["__output_dir"] = outputDirectory();
@@ -225,26 +255,30 @@ std::string ScriptProcessor::writeJsonConfig() {
       j[c.first] = c.second.flagValueDouble;
     }
   }
+  return j;
+}
+
+std::string ScriptProcessor::writeJsonConfig() {
+  auto j = configJson();
 
   std::string jsonFilename = "_" + sanitizeName(mRunningDirectory) +
                              std::to_string(long(this)) + "_config.json";
   if (mVerbose) {
     std::cout << "Writing json config: " << jsonFilename << std::endl;
   }
-  {
-    PushDirectory p(mRunningDirectory, mVerbose);
-    std::ofstream of(jsonFilename, std::ofstream::out);
-    if (of.good()) {
-      of << j.dump(4);
-      of.close();
-      if (!of.good()) {
-        std::cout << "Error writing json file." << std::endl;
-        return "";
-      }
-    } else {
+  // The script runs in the running directory and receives the bare name
+  std::ofstream of(pathInDirectory(mRunningDirectory, jsonFilename),
+                   std::ofstream::out);
+  if (of.good()) {
+    of << j.dump(4);
+    of.close();
+    if (!of.good()) {
       std::cout << "Error writing json file." << std::endl;
       return "";
     }
+  } else {
+    std::cout << "Error writing json file." << std::endl;
+    return "";
   }
   return jsonFilename;
 }
@@ -269,72 +303,420 @@ void ScriptProcessor::parametersToConfig(nlohmann::json &j) {
   }
 }
 
-std::string ScriptProcessor::makeCommandLine() {
-  std::string commandLine = mScriptCommand + " ";
+// Splits command on whitespace, as the shell did for the command string
+static std::vector<std::string> splitCommand(const std::string &command) {
+  std::vector<std::string> arguments;
+  std::stringstream ss(command);
+  std::string argument;
+  while (ss >> argument) {
+    arguments.push_back(argument);
+  }
+  return arguments;
+}
+
+std::vector<std::string>
+ScriptProcessor::scriptArguments(const std::string &configFile) {
+  auto arguments = splitCommand(mScriptCommand);
+  arguments.push_back(mScriptName);
+  arguments.push_back(configFile);
+  return arguments;
+}
+
+std::vector<std::string> ScriptProcessor::makeCommandArguments() {
+  auto arguments = splitCommand(mScriptCommand);
   for (auto &flag : configuration) {
+    std::string value;
     switch (flag.second.type) {
     case FLAG_STRING:
-      commandLine += flag.second.commandFlag + flag.second.flagValueStr + " ";
-
+      value = flag.second.flagValueStr;
       break;
     case FLAG_INT:
-      commandLine += flag.second.commandFlag +
-                     std::to_string(flag.second.flagValueInt) + " ";
+      value = std::to_string(flag.second.flagValueInt);
       break;
     case FLAG_DOUBLE:
-      commandLine += flag.second.commandFlag +
-                     std::to_string(flag.second.flagValueDouble) + " ";
+      value = std::to_string(flag.second.flagValueDouble);
+      break;
+    }
+    // A flag ending in a space (e.g. "-o ") is a separate argument
+    auto flagArguments = splitCommand(flag.second.commandFlag);
+    const std::string &commandFlag = flag.second.commandFlag;
+    if (commandFlag.size() > 0 && !isspace(commandFlag.back()) &&
+        flagArguments.size() > 0) {
+      flagArguments.back() += value;
+    } else {
+      flagArguments.push_back(value);
+    }
+    arguments.insert(arguments.end(), flagArguments.begin(),
+                     flagArguments.end());
+  }
+  return arguments;
+}
+
+void ScriptProcessor::prepareCapture(OutputCapture &capture,
+                                     const std::string &directory) {
+  capture.setEcho(mVerbose, true);
+  if (mLineCallback) {
+    capture.setLineCallback(mLineCallback);
+  }
+  if (mOutputLog.size() > 0) {
+    capture.setSpillFile(pathInDirectory(directory, mOutputLog));
+  }
+}
+
+void ScriptProcessor::storeResult(OutputCapture &capture, int exitStatus,
+                                  double seconds) {
+  capture.finish();
+  std::unique_lock<std::mutex> lk(mLastResultLock);
+  mLastResult.exitStatus = exitStatus;
+  mLastResult.output = capture.contents(CAPTURE_OUTPUT);
+  mLastResult.errorOutput = capture.contents(CAPTURE_ERROR);
+  mLastResult.outputSize = capture.totalSize();
+  mLastResult.truncated = capture.truncated();
+  mLastResult.seconds = seconds;
+}
+
+#ifdef TINC_SPAWN_PROCESSES
+
+bool ScriptProcessor::runCommand(const std::vector<std::string> &arguments,
+                                 const std::string &directory) {
+  if (arguments.size() == 0) {
+    return false;
+  }
+  if (mVerbose) {
+    std::cout << "ScriptProcessor command:";
+    for (auto &argument : arguments) {
+      std::cout << " " << argument;
+    }
+    std::cout << std::endl;
+  }
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(const_cast<char *>(argument.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  int outputPipe[2];
+  int errorPipe[2];
+  if (!ScriptWorkerPool::createPipe(outputPipe)) {
+    std::cerr << "ERROR creating pipe: " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (!ScriptWorkerPool::createPipe(errorPipe)) {
+    std::cerr << "ERROR creating pipe: " << strerror(errno) << std::endl;
+    ::close(outputPipe[0]);
+    ::close(outputPipe[1]);
+    return false;
+  }
+  // When stale runs are cancelled, the script gets its own process group so
+  // requestCancel() also reaches processes it started, which would otherwise
+  // keep the output pipes open. Otherwise it stays in the application's
+  // group and gets interrupts and hangups from the terminal with it.
+  bool ownGroup = cancelsStaleRuns();
+  auto startTime = std::chrono::steady_clock::now();
+  // The working directory is only changed in the child, so children in
+  // different directories can run concurrently.
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (ownGroup) {
+      setpgid(0, 0);
+    }
+    dup2(outputPipe[1], STDOUT_FILENO);
+    dup2(errorPipe[1], STDERR_FILENO);
+    ::close(outputPipe[0]);
+    ::close(outputPipe[1]);
+    ::close(errorPipe[0]);
+    ::close(errorPipe[1]);
+    if (directory.size() > 0 && chdir(directory.c_str()) != 0) {
+      _exit(127);
+    }
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  ::close(outputPipe[1]);
+  ::close(errorPipe[1]);
+  if (pid < 0) {
+    std::cerr << "ERROR starting process: " << strerror(errno) << std::endl;
+    ::close(outputPipe[0]);
+    ::close(errorPipe[0]);
+    return false;
+  }
+
+  pid_t killTarget = ownGroup ? -pid : pid;
+  {
+    std::unique_lock<std::mutex> lk(mChildProcessesLock);
+    mChildProcesses.push_back(killTarget);
+    if (ownGroup) {
+      setpgid(pid, pid); // Also set here in case the child hasn't run yet
+    }
+    if (cancelRequested()) {
+      kill(killTarget, SIGTERM);
+    }
+  }
+
+  OutputCapture capture(mOutputBufferSize);
+  prepareCapture(capture, directory);
+  struct pollfd fds[2];
+  fds[CAPTURE_OUTPUT] = {outputPipe[0], POLLIN, 0};
+  fds[CAPTURE_ERROR] = {errorPipe[0], POLLIN, 0};
+  for (auto &fd : fds) {
+    fcntl(fd.fd, F_SETFL, fcntl(fd.fd, F_GETFL) | O_NONBLOCK);
+  }
+  std::vector<char> buffer(1 << 16);
+  int openStreams = 2;
+  while (openStreams > 0) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "ERROR reading process output: " << strerror(errno)
+                << std::endl;
+      break;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || fds[i].revents == 0) {
+        continue;
+      }
+      // Drain everything available
+      while (true) {
+        ssize_t count = ::read(fds[i].fd, buffer.data(), buffer.size());
+        if (count > 0) {
+          capture.append(CaptureStream(i), buffer.data(), size_t(count));
+          continue;
+        }
+        if (count < 0 && errno == EINTR) {
+          continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          break;
+        }
+        ::close(fds[i].fd); // End of output or error
+        fds[i].fd = -1;
+        openStreams--;
+        break;
+      }
+    }
+  }
+  for (auto &fd : fds) {
+    if (fd.fd >= 0) {
+      ::close(fd.fd);
+    }
+  }
 
+  int status = 0;
+  int returnValue = -1;
+  {
+    // Removed before reaping so requestCancel() can't signal a reused id
+    std::unique_lock<std::mutex> lk(mChildProcessesLock);
+    mChildProcesses.erase(std::find(mChildProcesses.begin(),
+                                    mChildProcesses.end(), killTarget));
+  }
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      status = -1;
       break;
     }
   }
-  return commandLine;
+  if (status != -1 && WIFEXITED(status)) {
+    returnValue = WEXITSTATUS(status);
+  }
+  std::chrono::duration<double> runTime =
+      std::chrono::steady_clock::now() - startTime;
+  storeResult(capture, returnValue, runTime.count());
+
+  if (mVerbose) {
+    std::cout << "Script result: " << returnValue << std::endl;
+  }
+  return returnValue == 0;
 }
 
-bool ScriptProcessor::runCommand(const std::string &command) {
-  PushDirectory p(mRunningDirectory, mVerbose);
+#else
 
+bool ScriptProcessor::runCommand(const std::vector<std::string> &arguments,
+                                 const std::string &directory) {
+  PushDirectory p(directory, mVerbose);
+
+  std::string command;
+  for (auto &argument : arguments) {
+    command += "\"" + argument + "\" ";
+  }
   if (mVerbose) {
     std::cout << "ScriptProcessor command: " << command << std::endl;
   }
-  std::array<char, 128> buffer{0};
-  std::string output;
-  // FIXME fork if running async
+  auto startTime = std::chrono::steady_clock::now();
   FILE *pipe = popen(command.c_str(), "r");
   if (!pipe)
     throw std::runtime_error("popen() failed!");
-  while (!feof(pipe)) {
-    if (fgets(buffer.data(), 128, pipe) != nullptr) {
-      output += buffer.data();
-      if (mVerbose) {
-        std::cout << buffer.data() << std::endl;
-      }
-    }
+  // popen() only captures standard output
+  OutputCapture capture(mOutputBufferSize);
+  prepareCapture(capture, directory);
+  std::vector<char> buffer(1 << 16);
+  size_t count;
+  while ((count = fread(buffer.data(), 1, buffer.size(), pipe)) > 0) {
+    capture.append(CAPTURE_OUTPUT, buffer.data(), count);
   }
 
   int returnValue = 0;
-  // TODO: Put back return value checking. Currently crashing
-  //        int returnValue = -1;
   if (!ferror(pipe)) {
     returnValue = pclose(pipe);
   } else {
+    pclose(pipe);
     returnValue = -1;
   }
+  std::chrono::duration<double> runTime =
+      std::chrono::steady_clock::now() - startTime;
+  storeResult(capture, returnValue, runTime.count());
 
   if (mVerbose) {
     std::cout << "Script result: " << returnValue << std::endl;
-    std::cout << output << std::endl;
   }
   return returnValue == 0;
 }
 
-bool ScriptProcessor::writeMeta() {
+#endif
+
+bool ScriptProcessor::runJob(const std::string &configFile) {
+  if (!mWorkerPool) {
+    auto pool = std::make_shared<ScriptWorkerPool>();
+    auto harness =
+        ScriptWorkerPool::pythonHarness(splitCommand(mScriptCommand));
+    if (!pool->start(harness, mPersistentWorkers)) {
+      std::cerr << "ERROR starting script workers for '" << id
+                << "'. Running script as new process." << std::endl;
+      mPersistentWorkers = 0;
+      return runCommand(scriptArguments(configFile), mRunningDirectory);
+    }
+    mWorkerPool = pool;
+  }
+  nlohmann::json job;
+  job["__script"] = mScriptName;
+  job["__config_file"] = configFile;
+  job["__running_directory"] = mRunningDirectory;
+  if (mVerbose) {
+    std::cout << "ScriptProcessor job: " << job.dump() << std::endl;
+  }
+  auto startTime = std::chrono::steady_clock::now();
+  ScriptJobResult result;
+  bool ok = mWorkerPool->runJob(job, result);
+  std::chrono::duration<double> runTime =
+      std::chrono::steady_clock::now() - startTime;
+  // Workers return the output when the job is done
+  OutputCapture capture(mOutputBufferSize);
+  prepareCapture(capture, mRunningDirectory);
+  capture.append(CAPTURE_OUTPUT, result.output.data(), result.output.size());
+  storeResult(capture, result.exitStatus, runTime.count());
+  if (mVerbose) {
+    std::cout << "Script result: " << result.exitStatus << std::endl;
+  }
+  return ok && result.exitStatus == 0;
+}
+
+void ScriptProcessor::usePersistentWorkers(size_t numWorkers) {
+  std::unique_lock<std::mutex> lk(mProcessingLock);
+  mPersistentWorkers = numWorkers;
+  mWorkerPool = nullptr; // Restarted with new size on next process()
+}
+
+void ScriptProcessor::setWorkerPool(std::shared_ptr<ScriptWorkerPool> pool) {
+  std::unique_lock<std::mutex> lk(mProcessingLock);
+  mWorkerPool = pool;
+  if (!pool) {
+    mPersistentWorkers = 0;
+  }
+}
+
+void ScriptProcessor::setCacheIndex(std::shared_ptr<CacheIndex> index) {
+  std::unique_lock<std::mutex> lk(mProcessingLock);
+  mCacheIndex = index;
+}
+
+ScriptJobResult ScriptProcessor::lastResult() {
+  std::unique_lock<std::mutex> lk(mLastResultLock);
+  return mLastResult;
+}
+
+std::string ScriptProcessor::lastError() {
+  std::unique_lock<std::mutex> lk(mLastResultLock);
+  if (mLastResult.exitStatus == 0) {
+    return std::string();
+  }
+  std::string error =
+      "Script exited with status " + std::to_string(mLastResult.exitStatus);
+  const size_t maxErrorSize = 4096;
+  if (mLastResult.errorOutput.size() > maxErrorSize) {
+    error += ":\n..." + mLastResult.errorOutput.substr(
+                           mLastResult.errorOutput.size() - maxErrorSize);
+  } else if (mLastResult.errorOutput.size() > 0) {
+    error += ":\n" + mLastResult.errorOutput;
+  }
+  return error;
+}
+
+void ScriptProcessor::requestCancel() {
+  Processor::requestCancel();
+#ifdef TINC_SPAWN_PROCESSES
+  std::unique_lock<std::mutex> lk(mChildProcessesLock);
+  for (auto killTarget : mChildProcesses) {
+    kill(killTarget, SIGTERM); // The script, or its process group
+  }
+#endif
+}
+
+std::string ScriptProcessor::cacheKey() {
+  HashState state;
+  auto addString = [&state](const std::string &value) {
+    state.update(uint64_t(value.size()));
+    state.update(value);
+  };
+  auto addFile = [&state](const std::string &path) {
+    uint64_t fileHash = 0;
+    if (FileHasher::shared().fileHash(path, fileHash)) {
+      state.update(uint64_t(1));
+      state.update(fileHash);
+    } else {
+      state.update(uint64_t(0)); // Missing file
+    }
+  };
+  // The configuration as passed to the script. Keys of json objects are
+  // sorted, so equal configurations produce the same text.
+  addString(configJson().dump());
+  addString(mScriptCommand);
+  addFile(scriptFile(true));
+  for (size_t i = 0; i < mInputFileNames.size(); i++) {
+    addString(mInputFileNames[i]);
+    addFile(inputFile(true, int(i)));
+  }
+  return HashState::toHex(state.digest());
+}
+
+bool ScriptProcessor::writeMeta(const std::string &key, double computeSeconds) {
+  if (mCacheIndex) {
+    CacheIndexEntry entry;
+    entry.cacheKey = key;
+    entry.writtenNs = CacheIndex::nowNs();
+    entry.accessedNs = entry.writtenNs;
+    entry.computeSeconds = computeSeconds;
+    entry.processorId = id;
+    for (size_t i = 0; i < mOutputFileNames.size(); i++) {
+      auto file = outputFile(true, int(i));
+      struct stat s;
+      if (::stat(file.c_str(), &s) == 0) {
+        entry.sizeBytes += s.st_size;
+      }
+      entry.files.push_back(file);
+    }
+    if (mVerbose) {
+      std::cout << "Wrote cache in index: " << mCacheIndex->rootPath()
+                << std::endl;
+    }
+    return mCacheIndex->put(outputFile(), entry);
+  }
 
   nlohmann::json j;
 
   j["__tinc_metadata_version"] = DATASCRIPT_META_FORMAT_VERSION;
+  j["__cache_key"] = key;
   j["__script"] = scriptFile(false);
-  j["__script_modified"] = modified(scriptFile().c_str());
+  j["__script_modified"] = modified(scriptFile(true).c_str());
   j["__running_directory"] = runningDirectory();
   // TODO add support for multiple input and output files.
   j["__output_dir"] = outputDirectory();
@@ -362,20 +744,17 @@ bool ScriptProcessor::writeMeta() {
   if (mVerbose) {
     std::cout << "Wrote cache in: " << metaFilename() << std::endl;
   }
-  {
-    PushDirectory p(mRunningDirectory, mVerbose);
-    std::ofstream of(jsonFilename, std::ofstream::out);
-    if (of.good()) {
-      of << j.dump(4);
-      of.close();
-      if (!of.good()) {
-        std::cout << "Error writing json file." << std::endl;
-        return false;
-      }
-    } else {
+  std::ofstream of(jsonFilename, std::ofstream::out);
+  if (of.good()) {
+    of << j.dump(4);
+    of.close();
+    if (!of.good()) {
       std::cout << "Error writing json file." << std::endl;
       return false;
     }
+  } else {
+    std::cout << "Error writing json file." << std::endl;
+    return false;
   }
   return true;
 }
@@ -390,7 +769,46 @@ al_sec ScriptProcessor::modified(const char *path) const {
   return 0.;
 }
 
-bool ScriptProcessor::needsRecompute() {
+bool ScriptProcessor::needsRecompute(const std::string &key) {
+  CacheIndexEntry entry;
+  if (mCacheIndex && mCacheIndex->find(outputFile(), entry)) {
+    if (entry.cacheKey != key) {
+      if (mVerbose) {
+        std::cout << "Script, inputs or configuration changed: Recomputing. "
+                  << outputFile() << std::endl;
+      }
+      return true;
+    }
+  } else {
+    std::string storedKey;
+    if (!readMetaFile(key, storedKey)) {
+      return true;
+    }
+    if (storedKey != key) {
+      if (mVerbose) {
+        std::cout << "Script, inputs or configuration changed: Recomputing. "
+                  << metaFilename() << std::endl;
+      }
+      return true;
+    }
+    if (mCacheIndex) {
+      // Valid metadata from before the index was used
+      writeMeta(key);
+    }
+  }
+  for (size_t i = 0; i < mOutputFileNames.size(); i++) {
+    if (!al::File::exists(outputFile(true, int(i)))) {
+      return true;
+    }
+  }
+  if (mCacheIndex) {
+    mCacheIndex->touch(outputFile());
+  }
+  return false;
+}
+
+bool ScriptProcessor::readMetaFile(const std::string &key,
+                                   std::string &storedKey) {
   std::ifstream metaFileStream;
   metaFileStream.open(metaFilename(), std::ofstream::in);
 
@@ -399,7 +817,7 @@ bool ScriptProcessor::needsRecompute() {
       std::cout << "Failed to open metadata: Recomputing. " << metaFilename()
                 << std::endl;
     }
-    return true;
+    return false;
   }
   nlohmann::json metaData;
   try {
@@ -411,25 +829,37 @@ bool ScriptProcessor::needsRecompute() {
 
   metaFileStream.close();
   if (!metaData.is_object()) {
-    return true;
+    return false;
   }
 
-  if (metaData["__tinc_metadata_version"] != DATASCRIPT_META_FORMAT_VERSION) {
-    if (mVerbose) {
-      std::cout << "Metadata format mismatch. Forcing recompute" << std::endl;
+  if (metaData["__tinc_metadata_version"] == 0) {
+    // Version 0 metadata has no cache key. It is valid if modification times
+    // and configuration match.
+    if (metaData["__script_modified"] != modified(scriptFile(true).c_str())) {
+      return false;
     }
+    if (al::File::exists(inputFile()) && inputFile(false).size() > 0 &&
+        metaData["__input_modified"] != modified(inputFile().c_str())) {
+      return false;
+    }
+    auto config = configJson();
+    for (auto &option : configuration) {
+      if (metaData[option.first] != config[option.first]) {
+        return false;
+      }
+    }
+    storedKey = key;
     return true;
   }
-  if (metaData["__script_modified"] != modified(scriptFile().c_str())) {
-    return true;
-  }
-  if (al::File::exists(inputFile()) && inputFile(false).size() > 0) {
-    if (metaData["__input_modified"] != modified(inputFile().c_str())) {
-      return true;
+  if (metaData["__tinc_metadata_version"] != DATASCRIPT_META_FORMAT_VERSION ||
+      !metaData["__cache_key"].is_string()) {
+    if (mVerbose) {
+      std::cout << "Metadata format mismatch. Forcing recompute" << std::endl;
     }
+    return false;
   }
-
-  return false;
+  storedKey = metaData["__cache_key"];
+  return true;
 }
 
 std::string ScriptProcessor::metaFilename() {
@@ -439,3 +869,272 @@ std::string ScriptProcessor::metaFilename() {
       al::File::conformPathToOS(outPath) + outName + ".meta";
   return metafilename;
 }
+
+// --------------------------------------------------
+
+CacheManager::~CacheManager() {
+  {
+    std::unique_lock<std::mutex> lk(mMaintenanceLock);
+    mStopMaintenance = true;
+  }
+  mMaintenanceTrigger.notify_all();
+  if (mMaintenanceThread.joinable()) {
+    mMaintenanceThread.join(); // Finishes queued deletions
+  }
+}
+
+bool CacheManager::openCacheIndex(std::string rootPath) {
+  auto index = std::make_shared<CacheIndex>();
+  if (!index->open(rootPath)) {
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mIndexLock);
+    mCacheIndex = index;
+  }
+  for (auto *processor : mProcessors) {
+    useCacheIndex(processor, index);
+  }
+  return true;
+}
+
+void CacheManager::setBudget(uint64_t maxBytes, double maxAgeSeconds,
+                             double checkInterval) {
+  mMaxBytes = maxBytes;
+  mMaxAgeSeconds = maxAgeSeconds;
+  mCheckInterval = checkInterval;
+  if (maxBytes > 0 || maxAgeSeconds > 0) {
+    startMaintenance();
+  }
+  {
+    std::unique_lock<std::mutex> lk(mMaintenanceLock);
+    mNextBudgetCheck = std::chrono::steady_clock::now();
+  }
+  mMaintenanceTrigger.notify_all();
+}
+
+size_t CacheManager::enforceBudget() {
+  auto index = cacheIndex();
+  if (!index || (mMaxBytes == 0 && mMaxAgeSeconds <= 0)) {
+    return 0;
+  }
+  std::unique_lock<std::mutex> lk(mEvictionLock);
+  if (mMaxBytes > 0 && index->totalBytes() <= mMaxBytes &&
+      mMaxAgeSeconds <= 0) {
+    return 0;
+  }
+  auto entries = index->entries();
+  int64_t now = CacheIndex::nowNs();
+  auto idleSeconds = [now](const CacheIndexEntry &entry) {
+    return (now - std::max(entry.accessedNs, entry.writtenNs)) / 1e9;
+  };
+
+  size_t evicted = 0;
+  uint64_t totalBytes = 0;
+  std::vector<std::pair<std::string, CacheIndexEntry>> kept;
+  kept.reserve(entries.size());
+  for (auto &entry : entries) {
+    if (mMaxAgeSeconds > 0 && idleSeconds(entry.second) > mMaxAgeSeconds) {
+      evicted += evict(*index, entry.first, entry.second) ? 1 : 0;
+    } else {
+      totalBytes += entry.second.sizeBytes;
+      kept.push_back(std::move(entry));
+    }
+  }
+  if (mMaxBytes == 0 || totalBytes <= mMaxBytes) {
+    return evicted;
+  }
+
+  std::vector<std::pair<double, size_t>> order;
+  order.reserve(kept.size());
+  for (size_t i = 0; i < kept.size(); i++) {
+    auto &entry = kept[i].second;
+    double score;
+    if (mPolicy == CACHE_EVICT_COST_AWARE) {
+      // Compute time saved per byte, discounted by time since last use
+      score = entry.computeSeconds /
+              (std::max<uint64_t>(entry.sizeBytes, 1) *
+               (1.0 + idleSeconds(entry)));
+    } else {
+      score = -idleSeconds(entry);
+    }
+    order.push_back({score, i});
+  }
+  std::sort(order.begin(), order.end());
+  for (auto &candidate : order) {
+    if (totalBytes <= mMaxBytes) {
+      break;
+    }
+    auto &entry = kept[candidate.second];
+    if (evict(*index, entry.first, entry.second)) {
+      totalBytes -= entry.second.sizeBytes;
+      evicted++;
+    }
+  }
+  return evicted;
+}
+
+size_t CacheManager::clearCache() {
+  return clearCacheIf(
+      [](const std::string &, const CacheIndexEntry &) { return true; });
+}
+
+size_t CacheManager::clearCache(const std::string &processorId) {
+  return clearCacheIf(
+      [&](const std::string &, const CacheIndexEntry &entry) {
+        return entry.processorId == processorId;
+      });
+}
+
+size_t CacheManager::clearCache(
+    ParameterSpace &space,
+    std::map<std::string, std::pair<size_t, size_t>> indexRanges) {
+  auto index = cacheIndex();
+  if (!index) {
+    std::cerr << "ERROR: clearCache() needs a cache index. Call "
+                 "openCacheIndex() first."
+              << std::endl;
+    return 0;
+  }
+  auto root = space.rootPath.size() > 0
+                  ? al::File::conformPathToOS(space.rootPath)
+                  : std::string();
+  auto dimensions = space.dimensionsForFilesystem();
+  if (dimensions.size() == 0) {
+    // All outputs of the space share the root path
+    auto rootPath = index->relativePath(root);
+    return clearCacheIf([&](const std::string &path, const CacheIndexEntry &) {
+      return path.compare(0, rootPath.size(), rootPath) == 0;
+    });
+  }
+  std::unordered_set<std::string> runPaths;
+  auto cursor = space.createCursor(dimensions);
+  bool done = cursor.size() == 0;
+  while (!done) {
+    bool inRegion = true;
+    for (size_t i = 0; i < cursor.dimensionCount() && inRegion; i++) {
+      auto range = indexRanges.find(cursor.dimension(i)->getName());
+      if (range != indexRanges.end()) {
+        inRegion = cursor.index(i) >= range->second.first &&
+                   cursor.index(i) < range->second.second;
+      }
+    }
+    if (inRegion) {
+      auto path = al::File::conformPathToOS(root +
+                                            space.relativeRunPath(cursor));
+      runPaths.insert(index->relativePath(path));
+    }
+    done = cursor.increment();
+  }
+  return clearCacheIf([&](const std::string &path, const CacheIndexEntry &) {
+    // Match the run path directories the output is in
+    for (size_t end = path.find('/'); end != std::string::npos;
+         end = path.find('/', end + 1)) {
+      if (runPaths.find(path.substr(0, end + 1)) != runPaths.end()) {
+        return true;
+      }
+    }
+    return false;
+  });
+}
+
+size_t CacheManager::clearCacheIf(
+    std::function<bool(const std::string &, const CacheIndexEntry &)>
+        filter) {
+  auto index = cacheIndex();
+  if (!index) {
+    std::cerr << "ERROR: clearCache() needs a cache index. Call "
+                 "openCacheIndex() first."
+              << std::endl;
+    return 0;
+  }
+  std::unique_lock<std::mutex> lk(mEvictionLock);
+  size_t removed = 0;
+  for (auto &entry : index->entries()) {
+    if (filter(entry.first, entry.second) &&
+        evict(*index, entry.first, entry.second)) {
+      removed++;
+    }
+  }
+  return removed;
+}
+
+void CacheManager::waitForDeletions() {
+  std::unique_lock<std::mutex> lk(mMaintenanceLock);
+  mDeletionsDone.wait(lk, [this]() { return mPendingDeletions == 0; });
+}
+
+size_t CacheManager::pendingDeletions() {
+  std::unique_lock<std::mutex> lk(mMaintenanceLock);
+  return mPendingDeletions;
+}
+
+bool CacheManager::evict(CacheIndex &index, const std::string &storedPath,
+                         const CacheIndexEntry &entry) {
+  Deletion deletion;
+  deletion.path = index.fullPath(storedPath);
+  if (!index.remove(deletion.path)) {
+    return false;
+  }
+  for (auto &file : entry.files) {
+    deletion.files.push_back(index.fullPath(file));
+  }
+  // Metadata written before the index was used
+  deletion.files.push_back(deletion.path + ".meta");
+  startMaintenance();
+  {
+    std::unique_lock<std::mutex> lk(mMaintenanceLock);
+    mDeletions.push_back(std::move(deletion));
+    mPendingDeletions++;
+  }
+  mMaintenanceTrigger.notify_all();
+  return true;
+}
+
+void CacheManager::startMaintenance() {
+  std::unique_lock<std::mutex> lk(mMaintenanceLock);
+  if (!mMaintenanceThread.joinable() && !mStopMaintenance) {
+    mMaintenanceThread = std::thread(&CacheManager::maintenanceLoop, this);
+  }
+}
+
+void CacheManager::maintenanceLoop() {
+  std::unique_lock<std::mutex> lk(mMaintenanceLock);
+  while (true) {
+    if (mDeletions.size() == 0) {
+      if (mStopMaintenance) {
+        break;
+      }
+      if (mMaxBytes == 0 && mMaxAgeSeconds <= 0) {
+        mMaintenanceTrigger.wait(lk);
+        continue;
+      }
+      if (std::chrono::steady_clock::now() < mNextBudgetCheck) {
+        mMaintenanceTrigger.wait_until(lk, mNextBudgetCheck);
+        continue;
+      }
+      mNextBudgetCheck =
+          std::chrono::steady_clock::now() +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(mCheckInterval.load()));
+      lk.unlock();
+      enforceBudget();
+      lk.lock();
+      continue;
+    }
+    Deletion deletion = std::move(mDeletions.front());
+    mDeletions.pop_front();
+    lk.unlock();
+    // Keep files of outputs computed again since they were evicted
+    CacheIndexEntry entry;
+    auto index = cacheIndex();
+    if (!index || !index->find(deletion.path, entry)) {
+      for (auto &file : deletion.files) {
+        std::remove(file.c_str());
+      }
+    }
+    lk.lock();
+    mPendingDeletions--;
+    mDeletionsDone.notify_all();
+  }
+}
@@ -0,0 +1,360 @@
+#include "tinc/ScriptWorkerPool.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define TINC_SCRIPT_WORKERS_SUPPORTED
+#endif
+
+using namespace tinc;
+
+// Runs a script as __main__ once per job. The protocol is written to a copy
+// of stdout, and stdout is redirected to stderr so output not going through
+// sys.stdout can't corrupt the result stream.
+static const char *pythonHarnessCode = R"PY(
+import io, json, os, runpy, sys, traceback
+_results = os.fdopen(os.dup(1), 'w')
+os.dup2(2, 1)
+_stdout = sys.stdout
+for _line in sys.stdin:
+    _job = json.loads(_line)
+    _status = 0
+    _output = io.StringIO()
+    _cwd = os.getcwd()
+    _argv = sys.argv
+    _path = list(sys.path)
+    try:
+        if _job.get('__running_directory'):
+            os.chdir(_job['__running_directory'])
+        _script = os.path.abspath(_job['__script'])
+        sys.argv = [_job['__script'], _job['__config_file']]
+        sys.path.insert(0, os.path.dirname(_script))
+        sys.stdout = _output
+        runpy.run_path(_script, run_name='__main__')
+    except SystemExit as e:
+        if e.code is None:
+            _status = 0
+        elif isinstance(e.code, int):
+            _status = e.code
+        else:
+            _output.write(str(e.code))
+            _status = 1
+    except BaseException:
+        traceback.print_exc(file=_output)
+        _status = 1
+    finally:
+        sys.stdout = _stdout
+        sys.argv = _argv
+        sys.path[:] = _path
+        os.chdir(_cwd)
+    _results.write(json.dumps({'__tinc_job': _job['__tinc_job'],
+                               '__exit_status': _status,
+                               '__output': _output.getvalue()}) + '\n')
+    _results.flush()
+)PY";
+
+std::vector<std::string>
+ScriptWorkerPool::pythonHarness(std::vector<std::string> pythonCommand) {
+  pythonCommand.insert(pythonCommand.end(), {"-u", "-c", pythonHarnessCode});
+  return pythonCommand;
+}
+
+#ifdef TINC_SCRIPT_WORKERS_SUPPORTED
+
+// Blocks SIGPIPE on the calling thread while in scope, so writing to a worker
+// that has died fails with EPIPE instead of terminating the application. The
+// process-wide disposition of SIGPIPE is left alone.
+class SigpipeBlock {
+public:
+  SigpipeBlock() {
+    sigemptyset(&mSet);
+    sigaddset(&mSet, SIGPIPE);
+    sigset_t pending;
+    sigpending(&pending);
+    mWasPending = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mSet, &mPreviousMask);
+  }
+
+  ~SigpipeBlock() {
+    if (!mWasPending) {
+      // Discard SIGPIPE raised by writes made while blocked
+      sigset_t pending;
+      sigpending(&pending);
+      if (sigismember(&pending, SIGPIPE)) {
+        int signal;
+        sigwait(&mSet, &signal);
+      }
+    }
+    pthread_sigmask(SIG_SETMASK, &mPreviousMask, nullptr);
+  }
+
+private:
+  sigset_t mSet;
+  sigset_t mPreviousMask;
+  bool mWasPending;
+};
+
+bool ScriptWorkerPool::start(std::vector<std::string> arguments,
+                             size_t numWorkers) {
+  stop();
+  if (arguments.size() == 0 || numWorkers == 0) {
+    std::cerr << "ERROR: ScriptWorkerPool needs a command and at least one "
+                 "worker"
+              << std::endl;
+    return false;
+  }
+  std::unique_lock<std::mutex> lk(mWorkersLock);
+  mArguments = arguments;
+  mWorkers.resize(numWorkers);
+  for (auto &worker : mWorkers) {
+    if (!startWorker(worker)) {
+      for (auto &startedWorker : mWorkers) {
+        stopWorker(startedWorker);
+      }
+      mWorkers.clear();
+      return false;
+    }
+  }
+  mRunning = true;
+  return true;
+}
+
+void ScriptWorkerPool::stop() {
+  std::unique_lock<std::mutex> lk(mWorkersLock);
+  mRunning = false;
+  mWorkerFree.wait(lk, [this]() {
+    for (auto &worker : mWorkers) {
+      if (worker.busy) {
+        return false;
+      }
+    }
+    return true;
+  });
+  for (auto &worker : mWorkers) {
+    stopWorker(worker);
+  }
+  mWorkers.clear();
+  mWorkerFree.notify_all();
+}
+
+bool ScriptWorkerPool::runJob(nlohmann::json job, ScriptJobResult &result) {
+  result = ScriptJobResult();
+  Worker *worker = nullptr;
+  {
+    std::unique_lock<std::mutex> lk(mWorkersLock);
+    mWorkerFree.wait(lk, [&]() {
+      if (!mRunning) {
+        return true;
+      }
+      for (auto &w : mWorkers) {
+        if (!w.busy) {
+          worker = &w;
+          return true;
+        }
+      }
+      return false;
+    });
+    if (!mRunning) {
+      std::cerr << "ERROR: ScriptWorkerPool not running" << std::endl;
+      return false;
+    }
+    worker->busy = true;
+    // Restart workers that died on a previous job
+    if (worker->pid < 0 && !startWorker(*worker)) {
+      worker->busy = false;
+      mWorkerFree.notify_one();
+      return false;
+    }
+  }
+
+  uint64_t jobId = mNextJob++;
+  job["__tinc_job"] = jobId;
+  std::string message = job.dump() + "\n";
+  bool ok = true;
+  {
+    SigpipeBlock sigpipeBlock;
+    size_t written = 0;
+    while (written < message.size()) {
+      ssize_t count = ::write(worker->input, message.data() + written,
+                              message.size() - written);
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        ok = false;
+        break;
+      }
+      written += count;
+    }
+  }
+
+  std::string line;
+  while (ok) {
+    if (!readLine(*worker, line)) {
+      ok = false;
+      break;
+    }
+    nlohmann::json reply;
+    try {
+      reply = nlohmann::json::parse(line);
+    } catch (...) {
+      std::cerr << "ERROR: invalid reply from script worker: " << line
+                << std::endl;
+      continue;
+    }
+    if (!reply.is_object() || reply["__tinc_job"] != jobId) {
+      continue; // Not the reply to this job
+    }
+    if (reply["__exit_status"].is_number_integer()) {
+      result.exitStatus = reply["__exit_status"];
+    }
+    if (reply["__output"].is_string()) {
+      result.output = reply["__output"];
+    }
+    break;
+  }
+
+  std::unique_lock<std::mutex> lk(mWorkersLock);
+  if (!ok) {
+    std::cerr << "ERROR: script worker " << worker->pid << " died running job"
+              << std::endl;
+    stopWorker(*worker);
+  }
+  worker->busy = false;
+  mWorkerFree.notify_all();
+  return ok;
+}
+
+// dup2() clears the close-on-exec flag on the copies a child uses as standard
+// streams.
+bool ScriptWorkerPool::createPipe(int fds[2]) {
+#ifdef AL_LINUX
+  return pipe2(fds, O_CLOEXEC) == 0;
+#else
+  // Without pipe2(), a fork in another thread between pipe() and fcntl() can
+  // still inherit the descriptors.
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
+#endif
+}
+
+bool ScriptWorkerPool::startWorker(Worker &worker) {
+  int jobPipe[2];
+  int resultPipe[2];
+  if (!createPipe(jobPipe)) {
+    std::cerr << "ERROR creating pipe: " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (!createPipe(resultPipe)) {
+    std::cerr << "ERROR creating pipe: " << strerror(errno) << std::endl;
+    ::close(jobPipe[0]);
+    ::close(jobPipe[1]);
+    return false;
+  }
+
+  std::vector<char *> argv;
+  for (auto &argument : mArguments) {
+    argv.push_back(const_cast<char *>(argument.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(jobPipe[0], STDIN_FILENO);
+    dup2(resultPipe[1], STDOUT_FILENO);
+    ::close(jobPipe[0]);
+    ::close(jobPipe[1]);
+    ::close(resultPipe[0]);
+    ::close(resultPipe[1]);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  ::close(jobPipe[0]);
+  ::close(resultPipe[1]);
+  if (pid < 0) {
+    std::cerr << "ERROR starting script worker: " << strerror(errno)
+              << std::endl;
+    ::close(jobPipe[1]);
+    ::close(resultPipe[0]);
+    return false;
+  }
+  worker.pid = pid;
+  worker.input = jobPipe[1];
+  worker.output = resultPipe[0];
+  worker.buffer.clear();
+  return true;
+}
+
+void ScriptWorkerPool::stopWorker(Worker &worker) {
+  if (worker.input >= 0) {
+    ::close(worker.input); // Worker exits at end of input
+  }
+  if (worker.output >= 0) {
+    ::close(worker.output);
+  }
+  if (worker.pid > 0) {
+    int status;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+    }
+  }
+  worker.pid = -1;
+  worker.input = -1;
+  worker.output = -1;
+  worker.buffer.clear();
+}
+
+bool ScriptWorkerPool::readLine(Worker &worker, std::string &line) {
+  while (true) {
+    size_t end = worker.buffer.find('\n');
+    if (end != std::string::npos) {
+      line = worker.buffer.substr(0, end);
+      worker.buffer.erase(0, end + 1);
+      return true;
+    }
+    char data[4096];
+    ssize_t count = ::read(worker.output, data, sizeof(data));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    worker.buffer.append(data, count);
+  }
+}
+
+#else
+
+bool ScriptWorkerPool::start(std::vector<std::string> arguments,
+                             size_t numWorkers) {
+  std::cerr << "ScriptWorkerPool not supported on this platform" << std::endl;
+  return false;
+}
+
+void ScriptWorkerPool::stop() {}
+
+bool ScriptWorkerPool::runJob(nlohmann::json job, ScriptJobResult &result) {
+  return false;
+}
+
+bool ScriptWorkerPool::startWorker(Worker &worker) { return false; }
+
+void ScriptWorkerPool::stopWorker(Worker &worker) {}
+
+bool ScriptWorkerPool::readLine(Worker &worker, std::string &line) {
+  return false;
+}
+
+#endif
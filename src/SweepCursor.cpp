@@ -0,0 +1,124 @@
+#include "tinc/SweepCursor.hpp"
+
+using namespace tinc;
+
+SweepCursor::SweepCursor(std::vector<ParameterSpaceDimension *> dimensions,
+                         std::vector<std::string> names)
+    : mDimensions(dimensions), mNames(names) {
+  if (mNames.size() != mDimensions.size()) {
+    mNames.clear();
+    for (auto *dimension : mDimensions) {
+      mNames.push_back(dimension->getName());
+    }
+  }
+  mIndeces.resize(mDimensions.size(), 0);
+  mSizes.resize(mDimensions.size());
+  mStrides.resize(mDimensions.size());
+  uint64_t stride = 1;
+  for (size_t i = 0; i < mDimensions.size(); i++) {
+    mSizes[i] = mDimensions[i]->size();
+    mStrides[i] = stride;
+    stride *= mSizes[i];
+  }
+  mTotalSize = stride;
+}
+
+bool SweepCursor::increment() {
+  for (size_t i = 0; i < mIndeces.size(); i++) {
+    mIndeces[i]++;
+    if (mIndeces[i] >= mSizes[i]) {
+      mIndeces[i] = 0;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SweepCursor::reset() {
+  for (auto &index : mIndeces) {
+    index = 0;
+  }
+}
+
+size_t SweepCursor::indexFor(const ParameterSpaceDimension *dimension) const {
+  for (size_t i = 0; i < mDimensions.size(); i++) {
+    if (mDimensions[i] == dimension) {
+      return mIndeces[i];
+    }
+  }
+  return 0;
+}
+
+uint64_t SweepCursor::linearIndex() const {
+  uint64_t linearIndex = 0;
+  for (size_t i = 0; i < mIndeces.size(); i++) {
+    linearIndex += mIndeces[i] * mStrides[i];
+  }
+  return linearIndex;
+}
+
+bool SweepCursor::setLinearIndex(uint64_t linearIndex) {
+  if (linearIndex >= mTotalSize) {
+    return false;
+  }
+  for (size_t i = 0; i < mIndeces.size(); i++) {
+    mIndeces[i] = linearIndex % mSizes[i];
+    linearIndex /= mSizes[i];
+  }
+  return true;
+}
+
+std::map<std::string, size_t> SweepCursor::toMap() const {
+  std::map<std::string, size_t> indeces;
+  for (size_t i = 0; i < mDimensions.size(); i++) {
+    indeces[mNames[i]] = mIndeces[i];
+  }
+  return indeces;
+}
+
+// --------------------------------------------------
+
+const std::string &RunPathBuilder::build(const SweepCursor &cursor) {
+  size_t firstChanged = 0;
+  bool sameDimensions = mDimensions.size() == cursor.dimensionCount();
+  for (size_t i = 0; sameDimensions && i < mDimensions.size(); i++) {
+    sameDimensions = mDimensions[i] == cursor.dimension(i);
+  }
+  if (sameDimensions) {
+    while (firstChanged < mIndeces.size() &&
+           mIndeces[firstChanged] == cursor.index(firstChanged) &&
+           mVersions[firstChanged] == mDimensions[firstChanged]->version()) {
+      firstChanged++;
+    }
+    if (firstChanged == mIndeces.size()) {
+      return mPath;
+    }
+  } else {
+    mDimensions.resize(cursor.dimensionCount());
+    for (size_t i = 0; i < mDimensions.size(); i++) {
+      mDimensions[i] = cursor.dimension(i);
+    }
+    mIndeces.resize(mDimensions.size());
+    mVersions.resize(mDimensions.size());
+    mSegmentEnds.resize(mDimensions.size());
+  }
+  mPath.resize(firstChanged > 0 ? mSegmentEnds[firstChanged - 1] : 0);
+  for (size_t i = firstChanged; i < mDimensions.size(); i++) {
+    mIndeces[i] = cursor.index(i);
+    mVersions[i] = mDimensions[i]->version();
+    auto id = mDimensions[i]->idViewAt(mIndeces[i]);
+    mPath.append(id.data, id.size);
+    mPath += "/";
+    mSegmentEnds[i] = mPath.size();
+  }
+  return mPath;
+}
+
+void RunPathBuilder::reset() {
+  mPath.clear();
+  mDimensions.clear();
+  mIndeces.clear();
+  mVersions.clear();
+  mSegmentEnds.clear();
+}
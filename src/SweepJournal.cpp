@@ -0,0 +1,226 @@
+#include "tinc/SweepJournal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+// rename() replaces an existing file atomically
+#define TINC_SWEEP_JOURNAL_ATOMIC_RENAME
+#endif
+
+using namespace tinc;
+
+static const char journalMagic[8] = {'T', 'I', 'N', 'C', 'S', 'W', 'J', '2'};
+static const size_t journalRecordSize = sizeof(uint64_t) + sizeof(uint8_t);
+// Records are not compacted below this size, so small sweeps don't rewrite
+// the journal every few records
+static const size_t journalMinCompactBytes = 1 << 16;
+
+struct JournalHeader {
+  char magic[8];
+  uint64_t totalSamples;
+  uint64_t sweepId;
+  uint64_t bitmapBytes;
+};
+
+bool SweepJournal::open(uint64_t totalSamples, uint64_t sweepId) {
+  close();
+  std::unique_lock<std::mutex> lk(mLock);
+  mTotalSamples = totalSamples;
+  mSweepId = sweepId;
+  mRecordCount = 0;
+  mDoneBitmap.clear();
+  mDoneBitmap.resize((totalSamples + 7) / 8, 0);
+  mFailed.clear();
+
+  bool needsSnapshot = true;
+  std::FILE *file = std::fopen(mFilename.c_str(), "rb");
+  if (file) {
+    JournalHeader header;
+    if (std::fread(&header, sizeof(JournalHeader), 1, file) == 1 &&
+        memcmp(header.magic, journalMagic, sizeof(journalMagic)) == 0 &&
+        header.totalSamples == totalSamples && header.sweepId == sweepId &&
+        header.bitmapBytes == mDoneBitmap.size() &&
+        std::fread(mDoneBitmap.data(), 1, mDoneBitmap.size(), file) ==
+            mDoneBitmap.size()) {
+      needsSnapshot = false;
+      // Replay records. A truncated last record is ignored.
+      unsigned char record[journalRecordSize];
+      while (std::fread(record, journalRecordSize, 1, file) == 1) {
+        uint64_t index;
+        memcpy(&index, record, sizeof(uint64_t));
+        if (index >= totalSamples) {
+          continue;
+        }
+        if (record[sizeof(uint64_t)] == SAMPLE_DONE) {
+          mDoneBitmap[index / 8] |= (1 << (index % 8));
+          mFailed.erase(index);
+        } else if (record[sizeof(uint64_t)] == SAMPLE_FAILED) {
+          mFailed.insert(index);
+        }
+        mRecordCount++;
+      }
+    } else {
+      std::cerr << "WARNING: Discarding sweep journal " << mFilename
+                << " created for a different sweep" << std::endl;
+      mDoneBitmap.assign(mDoneBitmap.size(), 0);
+    }
+    std::fclose(file);
+  }
+  if (needsSnapshot || needsCompaction()) {
+    if (!compactLocked()) {
+      return false;
+    }
+  }
+  mFile = std::fopen(mFilename.c_str(), "ab");
+  if (!mFile) {
+    std::cerr << "ERROR opening sweep journal: " << mFilename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void SweepJournal::close() {
+  std::unique_lock<std::mutex> lk(mLock);
+  if (mFile) {
+    std::fclose(mFile);
+    mFile = nullptr;
+  }
+}
+
+bool SweepJournal::isDone(uint64_t index) {
+  std::unique_lock<std::mutex> lk(mLock);
+  if (index >= mTotalSamples) {
+    return false;
+  }
+  return (mDoneBitmap[index / 8] & (1 << (index % 8))) != 0;
+}
+
+uint64_t SweepJournal::doneCount(uint64_t begin, uint64_t end) {
+  std::unique_lock<std::mutex> lk(mLock);
+  uint64_t count = 0;
+  end = std::min(end, mTotalSamples);
+  for (uint64_t index = begin; index < end; index++) {
+    if (index % 8 == 0 && index + 8 <= end) {
+      uint8_t byte = mDoneBitmap[index / 8];
+      while (byte) {
+        count += byte & 1;
+        byte >>= 1;
+      }
+      index += 7;
+    } else if (mDoneBitmap[index / 8] & (1 << (index % 8))) {
+      count++;
+    }
+  }
+  return count;
+}
+
+std::vector<uint64_t> SweepJournal::failedIndeces() {
+  std::unique_lock<std::mutex> lk(mLock);
+  return std::vector<uint64_t>(mFailed.begin(), mFailed.end());
+}
+
+bool SweepJournal::recordDone(uint64_t index) {
+  std::unique_lock<std::mutex> lk(mLock);
+  if (index >= mTotalSamples) {
+    return false;
+  }
+  mDoneBitmap[index / 8] |= (1 << (index % 8));
+  mFailed.erase(index);
+  return appendRecord(index, SAMPLE_DONE);
+}
+
+bool SweepJournal::recordFailed(uint64_t index) {
+  std::unique_lock<std::mutex> lk(mLock);
+  if (index >= mTotalSamples) {
+    return false;
+  }
+  mFailed.insert(index);
+  return appendRecord(index, SAMPLE_FAILED);
+}
+
+bool SweepJournal::compact() {
+  std::unique_lock<std::mutex> lk(mLock);
+  return compactLocked();
+}
+
+bool SweepJournal::compactLocked() {
+  bool wasOpen = mFile != nullptr;
+  if (mFile) {
+    std::fclose(mFile);
+    mFile = nullptr;
+  }
+  // Write to a temporary file and replace, so a crash during compaction
+  // leaves the previous journal intact. Where rename() can't replace a file,
+  // the journal is removed first and a crash can lose it.
+  std::string tempFilename = mFilename + ".tmp";
+  std::FILE *file = std::fopen(tempFilename.c_str(), "wb");
+  if (!file) {
+    std::cerr << "ERROR writing sweep journal: " << tempFilename << std::endl;
+    return false;
+  }
+  bool ok = writeSnapshot(file);
+  ok &= std::fclose(file) == 0;
+  if (ok) {
+#ifndef TINC_SWEEP_JOURNAL_ATOMIC_RENAME
+    std::remove(mFilename.c_str());
+#endif
+    ok = std::rename(tempFilename.c_str(), mFilename.c_str()) == 0;
+  }
+  if (!ok) {
+    std::cerr << "ERROR compacting sweep journal: " << mFilename << std::endl;
+  }
+  mRecordCount = mFailed.size();
+  if (wasOpen) {
+    mFile = std::fopen(mFilename.c_str(), "ab");
+  }
+  return ok;
+}
+
+bool SweepJournal::appendRecord(uint64_t index, uint8_t status) {
+  if (!mFile) {
+    return false;
+  }
+  unsigned char record[journalRecordSize];
+  memcpy(record, &index, sizeof(uint64_t));
+  record[sizeof(uint64_t)] = status;
+  mRecordCount++;
+  if (std::fwrite(record, journalRecordSize, 1, mFile) != 1 ||
+      std::fflush(mFile) != 0) {
+    return false;
+  }
+  if (needsCompaction()) {
+    return compactLocked();
+  }
+  return true;
+}
+
+bool SweepJournal::needsCompaction() {
+  return mRecordCount * journalRecordSize >
+         std::max(mDoneBitmap.size(), journalMinCompactBytes);
+}
+
+bool SweepJournal::writeSnapshot(std::FILE *file) {
+  JournalHeader header;
+  memcpy(header.magic, journalMagic, sizeof(journalMagic));
+  header.totalSamples = mTotalSamples;
+  header.sweepId = mSweepId;
+  header.bitmapBytes = mDoneBitmap.size();
+  if (std::fwrite(&header, sizeof(JournalHeader), 1, file) != 1) {
+    return false;
+  }
+  if (std::fwrite(mDoneBitmap.data(), 1, mDoneBitmap.size(), file) !=
+      mDoneBitmap.size()) {
+    return false;
+  }
+  for (auto index : mFailed) {
+    unsigned char record[journalRecordSize];
+    memcpy(record, &index, sizeof(uint64_t));
+    record[sizeof(uint64_t)] = SAMPLE_FAILED;
+    if (std::fwrite(record, journalRecordSize, 1, file) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
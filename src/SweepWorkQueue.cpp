@@ -0,0 +1,277 @@
+#include "tinc/SweepWorkQueue.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(AL_OSX) || defined(AL_LINUX) || defined(AL_EMSCRIPTEN)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TINC_SWEEP_QUEUE_SUPPORTED
+#endif
+
+#if defined(AL_OSX)
+#include <sys/sysctl.h>
+#endif
+
+using namespace tinc;
+
+static const char queueMagic[8] = {'T', 'I', 'N', 'C', 'S', 'W', 'Q', '2'};
+
+#ifdef TINC_SWEEP_QUEUE_SUPPORTED
+
+// Holds exclusive lock on queue file while in scope
+class QueueFileLock {
+public:
+  QueueFileLock(int fd) : mFd(fd) { flock(mFd, LOCK_EX); }
+  ~QueueFileLock() { flock(mFd, LOCK_UN); }
+
+private:
+  int mFd;
+};
+
+// Start time of a running process in platform specific units. 0 if pid is
+// not running or is a zombie.
+static uint64_t processStartTime(int32_t pid) {
+  if (pid <= 0) {
+    return 0;
+  }
+#if defined(AL_LINUX)
+  std::ifstream statFile("/proc/" + std::to_string(pid) + "/stat");
+  std::string stat;
+  if (!std::getline(statFile, stat)) {
+    return 0;
+  }
+  // The command name in parentheses may contain spaces. Fields after it
+  // start with the state (field 3). The start time is field 22.
+  auto nameEnd = stat.rfind(')');
+  if (nameEnd == std::string::npos) {
+    return 0;
+  }
+  std::istringstream fields(stat.substr(nameEnd + 1));
+  std::string state;
+  fields >> state;
+  if (state == "Z" || state == "X") {
+    return 0;
+  }
+  std::string field;
+  for (int i = 4; i < 22; i++) {
+    fields >> field;
+  }
+  uint64_t startTime = 0;
+  fields >> startTime;
+  return fields ? startTime + 1 : 0;
+#elif defined(AL_OSX)
+  int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, pid};
+  struct kinfo_proc info;
+  size_t size = sizeof(info);
+  if (sysctl(mib, 4, &info, &size, nullptr, 0) != 0 || size == 0 ||
+      info.kp_proc.p_stat == SZOMB) {
+    return 0;
+  }
+  return uint64_t(info.kp_proc.p_starttime.tv_sec) * 1000000 +
+         info.kp_proc.p_starttime.tv_usec + 1;
+#else
+  // Start time not available. Reused pids are seen as alive.
+  return (kill(pid, 0) == 0 || errno == EPERM) ? 1 : 0;
+#endif
+}
+
+static bool processAlive(int32_t pid, uint64_t startTime) {
+  uint64_t currentStartTime = processStartTime(pid);
+  return currentStartTime != 0 && currentStartTime == startTime;
+}
+
+bool SweepWorkQueue::open(uint64_t totalSamples, uint64_t chunkSize,
+                          uint64_t sweepId) {
+  close();
+  if (chunkSize == 0) {
+    chunkSize = 1;
+  }
+  mFd = ::open(mFilename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (mFd < 0) {
+    std::cerr << "ERROR opening sweep queue: " << mFilename << " "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  QueueFileLock lock(mFd);
+  Header header;
+  if (!readHeader(header)) {
+    // New queue. Initialize header and records.
+    memcpy(header.magic, queueMagic, sizeof(queueMagic));
+    header.totalSamples = totalSamples;
+    header.chunkSize = chunkSize;
+    header.sweepId = sweepId;
+    header.nextFree = 0;
+    uint64_t chunkCount = (totalSamples + chunkSize - 1) / chunkSize;
+    if (ftruncate(mFd, sizeof(Header) + chunkCount * sizeof(ChunkRecord)) !=
+            0 ||
+        !writeHeader(header)) {
+      std::cerr << "ERROR initializing sweep queue: " << mFilename
+                << std::endl;
+      ::close(mFd);
+      mFd = -1;
+      return false;
+    }
+  } else if (header.totalSamples != totalSamples ||
+             header.chunkSize != chunkSize || header.sweepId != sweepId) {
+    std::cerr << "ERROR sweep queue " << mFilename
+              << " was created for a different sweep" << std::endl;
+    ::close(mFd);
+    mFd = -1;
+    return false;
+  }
+  mTotalSamples = totalSamples;
+  mChunkSize = chunkSize;
+  mChunkCount = (totalSamples + chunkSize - 1) / chunkSize;
+  return true;
+}
+
+void SweepWorkQueue::close() {
+  if (mFd >= 0) {
+    ::close(mFd);
+    mFd = -1;
+  }
+}
+
+bool SweepWorkQueue::remove() {
+  close();
+  if (::unlink(mFilename.c_str()) != 0 && errno != ENOENT) {
+    std::cerr << "ERROR removing sweep queue: " << mFilename << " "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SweepWorkQueue::claimChunk(uint64_t &begin, uint64_t &end) {
+  if (mFd < 0) {
+    return false;
+  }
+  QueueFileLock lock(mFd);
+  Header header;
+  if (!readHeader(header)) {
+    return false;
+  }
+  ChunkRecord record;
+  record.state = CHUNK_CLAIMED;
+  record.pid = getpid();
+  record.startTime = processStartTime(record.pid);
+  uint64_t chunk = header.nextFree;
+  if (chunk < mChunkCount) {
+    header.nextFree++;
+    if (!writeHeader(header)) {
+      return false;
+    }
+  } else {
+    // All chunks have been handed out. Look for chunks that were released or
+    // whose worker died.
+    ChunkRecord existing;
+    for (chunk = 0; chunk < mChunkCount; chunk++) {
+      if (!readRecord(chunk, existing)) {
+        return false;
+      }
+      if (existing.state == CHUNK_FREE ||
+          (existing.state == CHUNK_CLAIMED &&
+           !processAlive(existing.pid, existing.startTime))) {
+        break;
+      }
+    }
+    if (chunk == mChunkCount) {
+      return false;
+    }
+  }
+  if (!writeRecord(chunk, record)) {
+    return false;
+  }
+  begin = chunk * mChunkSize;
+  end = std::min(begin + mChunkSize, mTotalSamples);
+  return true;
+}
+
+bool SweepWorkQueue::completeChunk(uint64_t begin) {
+  return setChunkState(begin, CHUNK_DONE);
+}
+
+bool SweepWorkQueue::releaseChunk(uint64_t begin) {
+  return setChunkState(begin, CHUNK_FREE);
+}
+
+bool SweepWorkQueue::finished() {
+  if (mFd < 0) {
+    return false;
+  }
+  QueueFileLock lock(mFd);
+  ChunkRecord record;
+  for (uint64_t chunk = 0; chunk < mChunkCount; chunk++) {
+    if (!readRecord(chunk, record) || record.state != CHUNK_DONE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SweepWorkQueue::setChunkState(uint64_t begin, ChunkState state) {
+  if (mFd < 0 || begin >= mTotalSamples) {
+    return false;
+  }
+  QueueFileLock lock(mFd);
+  ChunkRecord record;
+  record.state = state;
+  record.pid = state == CHUNK_FREE ? 0 : getpid();
+  record.startTime = state == CHUNK_FREE ? 0 : processStartTime(record.pid);
+  return writeRecord(begin / mChunkSize, record);
+}
+
+bool SweepWorkQueue::readHeader(Header &header) {
+  if (pread(mFd, &header, sizeof(Header), 0) != sizeof(Header)) {
+    return false;
+  }
+  return memcmp(header.magic, queueMagic, sizeof(queueMagic)) == 0;
+}
+
+bool SweepWorkQueue::writeHeader(Header &header) {
+  return pwrite(mFd, &header, sizeof(Header), 0) == sizeof(Header);
+}
+
+bool SweepWorkQueue::readRecord(uint64_t chunk, ChunkRecord &record) {
+  return pread(mFd, &record, sizeof(ChunkRecord),
+               sizeof(Header) + chunk * sizeof(ChunkRecord)) ==
+         sizeof(ChunkRecord);
+}
+
+bool SweepWorkQueue::writeRecord(uint64_t chunk, ChunkRecord &record) {
+  return pwrite(mFd, &record, sizeof(ChunkRecord),
+                sizeof(Header) + chunk * sizeof(ChunkRecord)) ==
+         sizeof(ChunkRecord);
+}
+
+#else
+
+bool SweepWorkQueue::open(uint64_t totalSamples, uint64_t chunkSize,
+                          uint64_t sweepId) {
+  std::cerr << "SweepWorkQueue not supported on this platform" << std::endl;
+  return false;
+}
+
+void SweepWorkQueue::close() {}
+
+bool SweepWorkQueue::remove() { return false; }
+
+bool SweepWorkQueue::claimChunk(uint64_t &begin, uint64_t &end) {
+  return false;
+}
+
+bool SweepWorkQueue::completeChunk(uint64_t begin) { return false; }
+
+bool SweepWorkQueue::releaseChunk(uint64_t begin) { return false; }
+
+bool SweepWorkQueue::finished() { return false; }
+
+#endif
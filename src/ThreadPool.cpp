@@ -0,0 +1,392 @@
+#include "tinc/ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#if defined(AL_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#define TINC_THREAD_AFFINITY_SUPPORTED
+#endif
+
+using namespace tinc;
+
+namespace {
+// Set on worker threads
+thread_local ThreadPool *tCurrentPool = nullptr;
+thread_local void *tCurrentQueue = nullptr;
+} // namespace
+
+ThreadPool::ThreadPool(size_t numThreads) { startWorkers(numThreads); }
+
+ThreadPool::~ThreadPool() {
+  std::unique_lock<std::mutex> lk(mConfigLock);
+  stopWorkers();
+}
+
+void ThreadPool::submit(std::function<void()> task, const void *group) {
+  if (tCurrentPool == this) {
+    auto queue = static_cast<TaskQueue *>(tCurrentQueue);
+    std::unique_lock<std::mutex> lk(queue->lock);
+    queue->tasks.push_back({std::move(task), group});
+  } else {
+    std::unique_lock<std::mutex> lk(mSharedQueue.lock);
+    mSharedQueue.tasks.push_back({std::move(task), group});
+  }
+  mSubmitted++;
+  size_t queued = (size_t)std::max<int64_t>(++mQueued, 0);
+  size_t peak = mPeakQueued.load();
+  while (queued > peak && !mPeakQueued.compare_exchange_weak(peak, queued)) {
+  }
+  {
+    // Taking the lock orders the count change with sleeping workers' checks
+    std::unique_lock<std::mutex> lk(mSleepLock);
+  }
+  mTaskAvailable.notify_one();
+  mEvents++;
+  if (mWaiters > 0) {
+    {
+      std::unique_lock<std::mutex> lk(mSleepLock);
+    }
+    mStateChanged.notify_all();
+  }
+}
+
+void ThreadPool::submitAfter(double seconds, std::function<void()> task,
+                             const void *group) {
+  if (seconds <= 0.0) {
+    submit(std::move(task), group);
+    return;
+  }
+  DelayedTask delayed;
+  delayed.due = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(seconds));
+  delayed.task = std::move(task);
+  delayed.group = group;
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    mDelayed.push_back(std::move(delayed));
+    std::push_heap(mDelayed.begin(), mDelayed.end());
+    mNextDueNs = mDelayed.front().due.time_since_epoch() /
+                 std::chrono::nanoseconds(1);
+  }
+  // Wake a sleeping worker so it waits for the new deadline
+  mTaskAvailable.notify_one();
+}
+
+bool ThreadPool::runPendingTask() {
+  std::function<void()> task;
+  if (!popTask(task)) {
+    return false;
+  }
+  runTask(task);
+  return true;
+}
+
+void ThreadPool::waitUntil(const std::function<bool()> &done,
+                           std::vector<const void *> groups) {
+  std::sort(groups.begin(), groups.end());
+  std::function<void()> task;
+  while (true) {
+    // done is not called with mSleepLock held, as it may take locks that are
+    // held while submitting. Any submit or completion after reading events
+    // changes mEvents, so the wait below can't miss it.
+    uint64_t events = mEvents;
+    if (done()) {
+      break;
+    }
+    if (popGroupTask(task, groups)) {
+      runTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    mWaiters++;
+    if (mEvents == events) {
+      // The timeout covers work finishing outside the pool
+      mStateChanged.wait_for(lk, std::chrono::milliseconds(10));
+    }
+    mWaiters--;
+  }
+}
+
+size_t ThreadPool::size() {
+  std::unique_lock<std::mutex> lk(mConfigLock);
+  return mThreads.size();
+}
+
+void ThreadPool::setSize(size_t numThreads) {
+  if (tCurrentPool == this) {
+    std::cerr << "ERROR: ThreadPool::setSize() called from pool task"
+              << std::endl;
+    return;
+  }
+  std::unique_lock<std::mutex> lk(mConfigLock);
+  stopWorkers();
+  startWorkers(numThreads);
+}
+
+bool ThreadPool::setCpuAffinity(std::vector<int> cpus) {
+#ifdef TINC_THREAD_AFFINITY_SUPPORTED
+  std::unique_lock<std::mutex> lk(mConfigLock);
+  mCpus = cpus;
+  bool ok = true;
+  for (size_t i = 0; i < mThreads.size(); i++) {
+    ok &= applyAffinity(i);
+  }
+  return ok;
+#else
+  std::cerr << "ERROR: CPU affinity not supported on this platform"
+            << std::endl;
+  return false;
+#endif
+}
+
+ThreadPoolStats ThreadPool::stats() {
+  ThreadPoolStats s;
+  {
+    std::unique_lock<std::mutex> lk(mConfigLock);
+    s.threads = mThreads.size();
+    for (auto &queue : mWorkerQueues) {
+      std::unique_lock<std::mutex> qlk(queue->lock);
+      s.workerQueueDepths.push_back(queue->tasks.size());
+    }
+  }
+  s.activeTasks = mActive;
+  s.queuedTasks = (size_t)std::max<int64_t>(mQueued, 0);
+  s.peakQueuedTasks = mPeakQueued;
+  s.submitted = mSubmitted;
+  s.completed = mCompleted;
+  s.stolen = mStolen;
+  return s;
+}
+
+void ThreadPool::resetStats() {
+  mPeakQueued = (size_t)std::max<int64_t>(mQueued, 0);
+  mSubmitted = 0;
+  mCompleted = 0;
+  mStolen = 0;
+}
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::startWorkers(size_t numThreads) {
+  if (numThreads == 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  if (numThreads == 0) {
+    numThreads = 4;
+  }
+  mStopping = false;
+  mWorkerQueues.clear();
+  for (size_t i = 0; i < numThreads; i++) {
+    mWorkerQueues.emplace_back(new TaskQueue);
+  }
+  for (size_t i = 0; i < numThreads; i++) {
+    mThreads.emplace_back(&ThreadPool::workerLoop, this, i);
+    if (mCpus.size() > 0) {
+      applyAffinity(i);
+    }
+  }
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    mStopping = true;
+  }
+  mTaskAvailable.notify_all();
+  for (auto &thread : mThreads) {
+    thread.join();
+  }
+  mThreads.clear();
+}
+
+void ThreadPool::workerLoop(size_t index) {
+  tCurrentPool = this;
+  tCurrentQueue = mWorkerQueues[index].get();
+  std::function<void()> task;
+  while (true) {
+    if (std::chrono::steady_clock::now().time_since_epoch() /
+            std::chrono::nanoseconds(1) >=
+        mNextDueNs) {
+      releaseDueTasks();
+    }
+    if (popTask(task)) {
+      runTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    auto wake = [this]() {
+      return mStopping || mQueued > 0 ||
+             (!mDelayed.empty() &&
+              mDelayed.front().due <= std::chrono::steady_clock::now());
+    };
+    // No predicate loop here: a notification for a new delayed task must
+    // bring the worker back to take the new deadline.
+    if (!wake()) {
+      if (mDelayed.empty()) {
+        mTaskAvailable.wait(lk);
+      } else {
+        mTaskAvailable.wait_until(lk, mDelayed.front().due);
+      }
+    }
+    if (mStopping && mQueued <= 0) {
+      break; // Stopped and all queues drained. Delayed tasks stay queued
+    }
+  }
+  tCurrentPool = nullptr;
+  tCurrentQueue = nullptr;
+}
+
+bool ThreadPool::popTask(std::function<void()> &task) {
+  if (mQueued <= 0) {
+    return false;
+  }
+  TaskQueue *ownQueue = nullptr;
+  if (tCurrentPool == this) {
+    ownQueue = static_cast<TaskQueue *>(tCurrentQueue);
+    std::unique_lock<std::mutex> lk(ownQueue->lock);
+    if (!ownQueue->tasks.empty()) {
+      task = std::move(ownQueue->tasks.back().run);
+      ownQueue->tasks.pop_back();
+      mQueued--;
+      return true;
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lk(mSharedQueue.lock);
+    if (!mSharedQueue.tasks.empty()) {
+      task = std::move(mSharedQueue.tasks.front().run);
+      mSharedQueue.tasks.pop_front();
+      mQueued--;
+      return true;
+    }
+  }
+  // Worker queues are only replaced by setSize() while holding mConfigLock,
+  // after the workers have exited. Other threads hold it while stealing.
+  std::unique_lock<std::mutex> configLock(mConfigLock, std::defer_lock);
+  if (tCurrentPool != this) {
+    if (!configLock.try_lock()) {
+      return false;
+    }
+  }
+  for (auto &queue : mWorkerQueues) {
+    if (queue.get() == ownQueue) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(queue->lock);
+    if (!queue->tasks.empty()) {
+      task = std::move(queue->tasks.front().run);
+      queue->tasks.pop_front();
+      mQueued--;
+      mStolen++;
+      return true;
+    }
+  }
+  return false;
+}
+
+// groups must be sorted
+bool ThreadPool::popGroupTask(std::function<void()> &task,
+                              const std::vector<const void *> &groups) {
+  if (mQueued <= 0 || groups.empty()) {
+    return false;
+  }
+  auto take = [&](TaskQueue &queue) {
+    std::unique_lock<std::mutex> lk(queue.lock);
+    for (auto it = queue.tasks.begin(); it != queue.tasks.end(); it++) {
+      if (it->group &&
+          std::binary_search(groups.begin(), groups.end(), it->group)) {
+        task = std::move(it->run);
+        queue.tasks.erase(it);
+        mQueued--;
+        return true;
+      }
+    }
+    return false;
+  };
+  if (take(mSharedQueue)) {
+    return true;
+  }
+  // Same rules for worker queues as in popTask()
+  std::unique_lock<std::mutex> configLock(mConfigLock, std::defer_lock);
+  if (tCurrentPool != this) {
+    if (!configLock.try_lock()) {
+      return false;
+    }
+  }
+  for (auto &queue : mWorkerQueues) {
+    if (take(*queue)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::runTask(std::function<void()> &task) {
+  mActive++;
+  task();
+  task = nullptr;
+  mActive--;
+  mCompleted++;
+  mEvents++;
+  if (mWaiters > 0) {
+    {
+      std::unique_lock<std::mutex> lk(mSleepLock);
+    }
+    mStateChanged.notify_all();
+  }
+}
+
+void ThreadPool::releaseDueTasks() {
+  std::vector<DelayedTask> dueTasks;
+  {
+    std::unique_lock<std::mutex> lk(mSleepLock);
+    auto now = std::chrono::steady_clock::now();
+    while (!mDelayed.empty() && mDelayed.front().due <= now) {
+      std::pop_heap(mDelayed.begin(), mDelayed.end());
+      dueTasks.push_back(std::move(mDelayed.back()));
+      mDelayed.pop_back();
+    }
+    mNextDueNs = mDelayed.empty() ? std::numeric_limits<int64_t>::max()
+                                  : mDelayed.front().due.time_since_epoch() /
+                                        std::chrono::nanoseconds(1);
+  }
+  for (auto &delayed : dueTasks) {
+    submit(std::move(delayed.task), delayed.group);
+  }
+}
+
+bool ThreadPool::applyAffinity(size_t index) {
+#ifdef TINC_THREAD_AFFINITY_SUPPORTED
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  if (mCpus.size() == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &cpuSet);
+    }
+  } else {
+    int cpu = mCpus[index % mCpus.size()];
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      std::cerr << "ERROR: invalid CPU " << cpu << std::endl;
+      return false;
+    }
+    CPU_SET(cpu, &cpuSet);
+  }
+  int err = pthread_setaffinity_np(mThreads[index].native_handle(),
+                                   sizeof(cpu_set_t), &cpuSet);
+  if (err != 0) {
+    std::cerr << "ERROR setting affinity of pool thread " << index << ": "
+              << err << std::endl;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}